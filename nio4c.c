@@ -19,6 +19,7 @@
 static WSADATA wsa_data;
 #else /* _WIN32 */
 #include <signal.h>
+#include <time.h>
 #endif /* _WIN32 */
 
 static void *alloc_emul(void *ptr, size_t size) {
@@ -65,6 +66,26 @@ unsigned long nio_nextpower(unsigned long size) {
   return size;
 }
 
+unsigned long long nio_microtime(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq, count;
+
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+
+  return (unsigned long long)(count.QuadPart / freq.QuadPart) * 1000000ULL +
+         (unsigned long long)(count.QuadPart % freq.QuadPart) * 1000000ULL /
+             freq.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+unsigned long long nio_millisec(void) { return nio_microtime() / 1000; }
+
 int nio_initialize(nio_pollcreator creator) {
 #ifdef _WIN32
   _setmaxstdio(2048);
@@ -80,33 +101,3 @@ void nio_finalize(void) {
   WSACleanup();
 #endif
 }
-
-unsigned short nio_checksum(const void *buffer, int len) {
-  unsigned int acc;
-  unsigned short src;
-  unsigned char *octetptr;
-
-  acc = 0;
-  octetptr = (unsigned char *)buffer;
-
-  while (len > 1) {
-    src = (*octetptr) << 8;
-    octetptr += 1;
-
-    src |= (*octetptr);
-    octetptr += 1;
-
-    acc += src;
-    len -= 2;
-  }
-
-  if (len > 0) {
-    src = (*octetptr) << 8;
-    acc += src;
-  }
-
-  while (0 != (acc & 0xFFFF0000UL))
-    acc = (acc >> 16) + (acc & 0x0000FFFFUL);
-
-  return htons((unsigned short)acc);
-}
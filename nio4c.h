@@ -26,6 +26,7 @@
 #include <sys/ioctl.h>
 #include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #ifdef __linux__
@@ -167,6 +168,12 @@
 #define NIO_WRITE 2
 #define NIO_READWRITE (NIO_READ | NIO_WRITE)
 
+#define NIO_SOCKNONBLOCK 1
+#define NIO_SOCKCLOEXEC 2
+
+#define NIO_REUSEPORT_CPU 1
+#define NIO_REUSEPORT_HASH 2
+
 #define nio_entry(ptr, type, member)                                           \
   ((type *)((char *)(ptr)-offsetof(type, member)))
 
@@ -212,12 +219,24 @@ typedef struct niopoll_s {
 
 typedef niopoll_t *(*nio_pollcreator)(void);
 
+/* "epoll", "kqueue", "poll" or "select", NULL if not available here */
+NIO_API nio_pollcreator nio_pollbackend(const char *name);
+
 NIO_API void nio_setalloc(void *(*allocator)(void *, size_t));
 
 NIO_API int nio_initialize(nio_pollcreator creator);
 NIO_API void nio_finalize(void);
 
+/* monotonic clock in milliseconds */
+NIO_API unsigned long long nio_millisec(void);
+
 NIO_API unsigned short nio_checksum(const void *buffer, int len);
+/* sum is a nio_checksum result, the replaced range must start on an even
+ * offset of the checksummed data */
+NIO_API unsigned short nio_checksumupdate(unsigned short sum,
+                                          const void *oldbuf,
+                                          const void *newbuf, int len);
+NIO_API unsigned short nio_copychecksum(void *dst, const void *src, int len);
 NIO_API const char *nio_gethostname(void);
 NIO_API int nio_gethwaddr(niohwaddr_t *hwaddr, int count);
 
@@ -236,11 +255,37 @@ NIO_API int nio_inprogress(void);
 NIO_API int nio_createtcp(niosocket_t *s, int af);
 NIO_API int nio_createtcp4(niosocket_t *s);
 NIO_API int nio_createtcp6(niosocket_t *s);
+/* flags: NIO_SOCKNONBLOCK | NIO_SOCKCLOEXEC, set by socket() where supported */
+NIO_API int nio_createtcpex(niosocket_t *s, int af, int flags);
 
 NIO_API int nio_createudp(niosocket_t *s, int af);
 NIO_API int nio_createudp4(niosocket_t *s);
 NIO_API int nio_createudp6(niosocket_t *s);
 
+/* type: SOCK_STREAM, SOCK_DGRAM or SOCK_SEQPACKET, POSIX only */
+NIO_API int nio_createunix(niosocket_t *s, int type);
+/* a leading '@' names the Linux abstract namespace, nothing on disk */
+NIO_API int nio_unixaddr(niosockaddr_t *addr, const char *path);
+/* returns: path length, '@' prefixed when abstract, -1 = not AF_UNIX */
+NIO_API int nio_unixpath(const niosockaddr_t *addr, char *path, int len);
+
+#define NIO_MAXFDS 64
+
+/* SCM_RIGHTS over AF_UNIX, the sender keeps its copies open, an empty data
+ * buffer still carries one placeholder octet, returns octets sent */
+NIO_API int nio_sendfds(niosocket_t *s, const int *fds, int count,
+                        const void *data, int len);
+/* count holds the capacity of fds and receives how many arrived, received
+ * fds are close-on-exec, returns octets received, 0 = peer closed */
+NIO_API int nio_recvfds(niosocket_t *s, int *fds, int *count, void *data,
+                        int len);
+/* hands listeners and connections to another process, e.g. across a binary
+ * upgrade, queued connections stay in the listener's accept queue, prefer
+ * SOCK_SEQPACKET, returns the count received, extras beyond count close */
+NIO_API int nio_sendsockets(niosocket_t *s, const niosocket_t *socks,
+                            int count);
+NIO_API int nio_recvsockets(niosocket_t *s, niosocket_t *socks, int count);
+
 NIO_API void nio_initsocket(niosocket_t *s);
 NIO_API void nio_closesocket(niosocket_t *s);
 NIO_API void nio_destroysocket(niosocket_t *s);
@@ -258,20 +303,56 @@ NIO_API int nio_listen(niosocket_t *s, int backlog);
 NIO_API int nio_connect(niosocket_t *s, const niosockaddr_t *addr);
 NIO_API int nio_accept(niosocket_t *s, niosocket_t *client,
                        niosockaddr_t *addr);
+/* drains up to count connections from a non-blocking listener, addrs may be
+ * NULL, returns: accepted count, 0 = none pending, -1 = error */
+NIO_API int nio_acceptmany(niosocket_t *s, niosocket_t *clients,
+                           niosockaddr_t *addrs, int count, int flags);
 NIO_API int nio_shutdown(niosocket_t *s, int how);
 NIO_API int nio_peeraddr(niosocket_t *s, niosockaddr_t *addr);
 NIO_API int nio_peeripstr(niosocket_t *s, nioipstr_t *addr);
 NIO_API int nio_sockaddr(niosocket_t *s, niosockaddr_t *addr);
 NIO_API int nio_sockipstr(niosocket_t *s, nioipstr_t *addr);
 
+NIO_API int nio_socketerror(niosocket_t *s);
 NIO_API int nio_socketnonblock(niosocket_t *s, int on);
 NIO_API int nio_reuseaddr(niosocket_t *s, int on);
 NIO_API int nio_tcpnodelay(niosocket_t *s, int on);
 NIO_API int nio_tcpkeepalive(niosocket_t *s, int on);
 NIO_API int nio_tcpkeepvalues(niosocket_t *s, int idle, int interval,
                               int count);
+NIO_API int nio_reuseport(niosocket_t *s, int on);
+/* Linux only, listeners[i] must be the i-th socket bound to the port and is
+ * picked by incoming CPU (serve it from a thread pinned to CPU i) or hash,
+ * count must be a power of two */
+NIO_API int nio_reuseportgroup(niosocket_t *listeners, int count, int policy);
+/* returns -1 where the platform lacks the option */
+NIO_API int nio_tcpfastopen(niosocket_t *s, int qlen);
+/* returns bytes taken, 0 means send the data once the connect completes */
+NIO_API int nio_connectfastopen(niosocket_t *s, const niosockaddr_t *addr,
+                                const void *data, int len);
+/* BSD accept filters need a listening socket and ignore seconds */
+NIO_API int nio_deferaccept(niosocket_t *s, int seconds);
 NIO_API int nio_udpbroadcast(niosocket_t *s, int on);
 
+/* times in microseconds, fields the platform lacks are 0 */
+typedef struct niotcpinfo_s {
+  int established;
+  unsigned int rtt; /* smoothed */
+  unsigned int rttvar;
+  unsigned int minrtt;
+  unsigned int cwnd; /* segments */
+  unsigned int mss;
+  unsigned int unacked;     /* segments in flight */
+  unsigned int retransmits; /* segments, over the connection lifetime */
+  unsigned long long deliveryrate; /* octets per second */
+  unsigned long long pacingrate;   /* octets per second */
+  unsigned long long bytesacked;
+} niotcpinfo_t;
+
+/* Linux TCP_INFO, macOS TCP_CONNECTION_INFO, FreeBSD TCP_INFO */
+NIO_API int nio_tcpinfo(niosocket_t *s, niotcpinfo_t *info);
+
+/* timedout in milliseconds, UINT_MAX waits forever */
 NIO_API int nio_socketreadable(niosocket_t *s, unsigned int timedout);
 NIO_API int nio_socketwritable(niosocket_t *s, unsigned int timedout);
 
@@ -283,6 +364,12 @@ NIO_API int nio_recvfrom(niosocket_t *s, niosockaddr_t *addr, void *buffer,
                          int len);
 NIO_API int nio_sendall(niosocket_t *s, const void *buffer, int len);
 NIO_API int nio_recvall(niosocket_t *s, void *buffer, int len);
+/* blocking or not, deadline is absolute nio_millisec time, returns what
+ * was transferred by then, -1 on error */
+NIO_API int nio_sendalldeadline(niosocket_t *s, const void *buffer, int len,
+                                unsigned long long deadline);
+NIO_API int nio_recvalldeadline(niosocket_t *s, void *buffer, int len,
+                                unsigned long long deadline);
 
 /* multiaddr: 224.0.0.0 ~ 239.255.255.255, FF00::/8 */
 NIO_API int nio_addmembership(niosocket_t *s, const niosockaddr_t *multiaddr);
@@ -295,6 +382,24 @@ NIO_API int nio_multicastttl(niosocket_t *s, const niosockaddr_t *multiaddr,
 NIO_API int nio_pipe(niosocket_t socks[2]);
 NIO_API int nio_popen(niosocket_t *s, const char *cmdline);
 
+typedef struct nioprocess_s {
+  int pid;
+  niosocket_t in;   /* child stdin */
+  niosocket_t out;  /* child stdout */
+  niosocket_t err;  /* child stderr */
+  /* pidfd, readable once the child exits, Linux 5.3+ only, invalid
+   * elsewhere, poll nio_reap there instead */
+  niosocket_t exit;
+} nioprocess_t;
+
+/* no shell, file is searched in PATH, envp NULL inherits, POSIX only */
+NIO_API int nio_spawn(nioprocess_t *proc, const char *file,
+                      char *const argv[], char *const envp[]);
+/* returns: 1 = reaped into status, 0 = still running, -1 = error */
+NIO_API int nio_reap(nioprocess_t *proc, int *status, int block);
+/* closes the channels and the pidfd, does not wait for the child */
+NIO_API void nio_destroyprocess(nioprocess_t *proc);
+
 typedef struct nioselector_s nioselector_t;
 typedef struct niomonitor_s niomonitor_t;
 
@@ -311,10 +416,185 @@ NIO_API int selector_select(nioselector_t *selector, niomonitor_t **monitors,
                             int count, unsigned int millisec);
 NIO_API int selector_wakeup(nioselector_t *selector);
 NIO_API int selector_close(nioselector_t *selector);
+/* spin on non-blocking waits for up to usec before sleeping, 0 disables */
+NIO_API int selector_setbusypoll(nioselector_t *selector, unsigned int usec);
 NIO_API int selector_registered(nioselector_t *selector, niosocket_t *io);
+
+#define NIO_STATSBUCKETS 16
+
+/* times in microseconds, define NIO_NOSTATS when building to compile the
+ * counters out, selector_stats then returns -1 */
+typedef struct nioselectorstats_s {
+  unsigned long long waits;
+  unsigned long long events;
+  /* [0] = no events, [i] = 2^(i-1) ~ 2^i-1 events, the last is open ended */
+  unsigned long long eventsperwait[NIO_STATSBUCKETS];
+  unsigned long long blocked;  /* inside the poll backend */
+  unsigned long long handling; /* between waits, handlers/timers/tasks */
+  unsigned long long interestchanges; /* poll backend ioevent calls */
+  unsigned long long wakeups;         /* selector_wakeup octets written */
+  unsigned long long coalesced;       /* selector_wakeup calls folded */
+  int registered;
+} nioselectorstats_t;
+
+NIO_API int selector_stats(nioselector_t *selector,
+                           nioselectorstats_t *stats);
+
+#define NIO_LATENCYBUCKETS 128
+
+/* time from selector_select returning to being called again, the work one
+ * loop iteration did outside the poll backend, in microseconds */
+typedef struct nioselectorlatency_s {
+  unsigned long long count;
+  unsigned long long total;
+  unsigned long long max;
+  unsigned long long buckets[NIO_LATENCYBUCKETS]; /* log-linear, 25% wide */
+} nioselectorlatency_t;
+
+/* runs on the selector thread at the start of the call after a slow one,
+ * the stall is measured after the fact, a handler that never returns is
+ * never reported, watch for that from another thread if it matters */
+typedef void (*nio_stallcallback)(void *ud, unsigned long long usec);
+
+NIO_API int selector_latency(nioselector_t *selector,
+                             nioselectorlatency_t *latency);
+NIO_API int selector_resetlatency(nioselector_t *selector);
+/* threshold in microseconds, a NULL callback disables the detector */
+NIO_API int selector_setstall(nioselector_t *selector,
+                              unsigned long long threshold,
+                              nio_stallcallback callback, void *ud);
+/* returns the upper bound of the bucket holding the percentile, 0 ~ 100 */
+NIO_API unsigned long long
+nio_latencypercentile(const nioselectorlatency_t *latency, double percentile);
 NIO_API int selector_closed(nioselector_t *selector);
 NIO_API int selector_empty(nioselector_t *selector);
 
+#define NIO_RESOLVEMAX 16
+
+/* count is 0 when the lookup failed or the selector was destroyed first,
+ * addrs must not be read then */
+typedef void (*nio_resolvecallback)(void *ud, const niosockaddr_t *addrs,
+                                    int count);
+
+/* resolves on worker threads, callback runs inside selector_select */
+NIO_API int selector_resolve(nioselector_t *selector, const char *hostname,
+                             unsigned short port, int af,
+                             nio_resolvecallback callback, void *ud);
+/* cache lifetime in milliseconds, getaddrinfo does not expose record TTLs */
+NIO_API int selector_resolvettl(nioselector_t *selector, unsigned int positive,
+                                unsigned int negative);
+
+/* s is NULL when every attempt failed or timed out, or when the selector
+ * was destroyed first, copy it to keep it */
+typedef void (*nio_connectcallback)(void *ud, niosocket_t *s,
+                                    const niosockaddr_t *addr);
+
+/* Happy Eyeballs (RFC 8305), timeout in milliseconds, 0 waits forever */
+NIO_API int selector_connect(nioselector_t *selector,
+                             const niosockaddr_t *addrs, int count,
+                             unsigned int timeout,
+                             nio_connectcallback callback, void *ud);
+NIO_API int selector_connecthost(nioselector_t *selector, const char *hostname,
+                                 unsigned short port, unsigned int timeout,
+                                 nio_connectcallback callback, void *ud);
+
+/* the monitor reports NIO_READ once per batch of deliveries, one watcher per
+ * signal per process, selector_destroy unwatches it. Linux routes the signal
+ * through signalfd, which only sees it while every thread blocks it: block
+ * it with pthread_sigmask before creating threads, a thread that leaves it
+ * unblocked takes the signal with its default action instead */
+NIO_API niomonitor_t *selector_watchsignal(nioselector_t *selector, int signo,
+                                           void *ud);
+NIO_API int selector_unwatchsignal(nioselector_t *selector,
+                                   niomonitor_t *monitor);
+
+typedef struct nioconnpool_s nioconnpool_t;
+
+/* maxidle pool wide, maxperhost idle per destination, idletimeout in
+ * milliseconds, 0 keeps idle connections until the peer closes them */
+NIO_API nioconnpool_t *nio_connpool(nioselector_t *selector, int maxidle,
+                                    int maxperhost, unsigned int idletimeout);
+
+/* before selector_destroy, idle connections are registered with it */
+NIO_API void connpool_destroy(nioconnpool_t *pool);
+/* returns: 1 = s is an idle connection to addr, 0 = nothing pooled */
+NIO_API int connpool_acquire(nioconnpool_t *pool, const niosockaddr_t *addr,
+                             niosocket_t *s);
+/* s must be deregistered, the pool owns it afterwards and may close it
+ * right away when full */
+NIO_API int connpool_release(nioconnpool_t *pool, const niosockaddr_t *addr,
+                             niosocket_t *s);
+NIO_API int connpool_idle(nioconnpool_t *pool);
+
+typedef struct niolistener_s niolistener_t;
+
+/* the callback owns s, which is non-blocking and close-on-exec */
+typedef void (*nio_acceptcallback)(void *ud, niosocket_t *s,
+                                   const niosockaddr_t *addr);
+
+/* maxaccept caps accepts per selector_select, 0 picks a default, the
+ * listening socket stays owned by the caller */
+NIO_API niolistener_t *nio_listener(nioselector_t *selector, niosocket_t *s,
+                                    int maxaccept, nio_acceptcallback callback,
+                                    void *ud);
+
+NIO_API void listener_destroy(niolistener_t *listener);
+/* paused while backing off from descriptor exhaustion */
+NIO_API int listener_paused(niolistener_t *listener);
+
+typedef struct niotcpsampler_s niotcpsampler_t;
+
+/* one round over the selector's established TCP connections */
+typedef struct niotcpaggregate_s {
+  int connections;
+  unsigned int minrtt; /* microseconds */
+  unsigned int avgrtt;
+  unsigned int maxrtt;
+  unsigned long long retransmits;  /* sum over the connections */
+  unsigned long long deliveryrate; /* sum, octets per second */
+  unsigned long long sampled;      /* nio_millisec of the round */
+} niotcpaggregate_t;
+
+/* once per connection per round, monitors closed by an earlier callback of
+ * the same round are skipped, closed monitors stay valid until
+ * selector_select returns */
+typedef void (*nio_tcpsamplecallback)(void *ud, niomonitor_t *monitor,
+                                      const niotcpinfo_t *info);
+
+/* interval in milliseconds, callback may be NULL to only aggregate */
+NIO_API niotcpsampler_t *nio_tcpsampler(nioselector_t *selector,
+                                        unsigned int interval,
+                                        nio_tcpsamplecallback callback,
+                                        void *ud);
+
+NIO_API void tcpsampler_destroy(niotcpsampler_t *sampler);
+/* returns -1 until the first round has run, or once sampling has stopped
+ * because the next round could not be scheduled */
+NIO_API int tcpsampler_last(niotcpsampler_t *sampler,
+                            niotcpaggregate_t *aggregate);
+
+typedef struct nioshmchannel_s nioshmchannel_t;
+
+/* memfd, doorbell read end, doorbell write end (same eventfd on Linux) */
+#define NIO_SHMFDS 3
+
+/* single producer, single consumer, capacity rounds up to a power of two,
+ * survives fork, pass the fds to other processes to attach */
+NIO_API nioshmchannel_t *nio_shmchannel(unsigned int capacity);
+/* takes ownership of fds */
+NIO_API nioshmchannel_t *nio_shmchannelattach(const int fds[NIO_SHMFDS]);
+
+NIO_API void shmchannel_destroy(nioshmchannel_t *channel);
+NIO_API int shmchannel_fds(nioshmchannel_t *channel, int fds[NIO_SHMFDS]);
+/* consumer side, register for NIO_READ, read until empty before waiting */
+NIO_API niosocket_t *shmchannel_io(nioshmchannel_t *channel);
+/* returns: len = queued, 0 = ring full, -1 = empty or larger than the ring */
+NIO_API int shmchannel_write(nioshmchannel_t *channel, const void *data,
+                             int len);
+/* returns: message size, 0 = empty, -1 = buf too small or corrupt ring */
+NIO_API int shmchannel_read(nioshmchannel_t *channel, void *buf, int len);
+NIO_API int shmchannel_peeksize(nioshmchannel_t *channel);
+
 NIO_API void monitor_destroy(niomonitor_t *monitor);
 NIO_API void *monitor_userdata(niomonitor_t *monitor);
 NIO_API niosocket_t *monitor_io(niomonitor_t *monitor);
@@ -328,6 +608,74 @@ NIO_API int monitor_writable(niomonitor_t *monitor);
 NIO_API int monitor_exception(niomonitor_t *monitor);
 NIO_API int monitor_closed(niomonitor_t *monitor);
 
+typedef struct niobuffer_s niobuffer_t;
+typedef struct niochannel_s niochannel_t;
+
+typedef struct nioslice_s {
+  const void *data;
+  int len;
+} nioslice_t;
+
+typedef struct nioframing_s {
+  int lensize;   /* 2, 4 or 8 octets */
+  int byteorder; /* NIO_BIGENDIAN or NIO_LILENDIAN */
+  int maxsize;   /* max payload size */
+} nioframing_t;
+
+typedef struct niodelimiter_s {
+  const char *delim; /* e.g. "\r\n" */
+  int len;
+  int maxsize; /* max record size, delimiter excluded */
+} niodelimiter_t;
+
+/* the reference count is atomic, threads may retain and release a buffer
+ * but must not change its data once it is shared */
+NIO_API niobuffer_t *nio_buffer(const void *data, int len);
+
+NIO_API niobuffer_t *buffer_retain(niobuffer_t *buffer);
+NIO_API void buffer_release(niobuffer_t *buffer);
+NIO_API void *buffer_data(niobuffer_t *buffer);
+NIO_API int buffer_size(niobuffer_t *buffer);
+
+/* monitor is optional, NIO_WRITE is managed on it while output is pending,
+ * io must be non-blocking or channel_write, channel_send and nio_fanout
+ * block until the peer reads */
+NIO_API niochannel_t *nio_channel(niosocket_t *io, niomonitor_t *monitor);
+
+NIO_API void channel_destroy(niochannel_t *channel);
+NIO_API niosocket_t *channel_io(niochannel_t *channel);
+NIO_API niomonitor_t *channel_monitor(niochannel_t *channel);
+NIO_API int channel_write(niochannel_t *channel, niobuffer_t *buffer);
+NIO_API int channel_send(niochannel_t *channel, const void *data, int len);
+NIO_API int channel_flush(niochannel_t *channel);
+NIO_API int channel_pending(niochannel_t *channel);
+
+/* slices point into the input buffer until the next channel_read */
+NIO_API int channel_read(niochannel_t *channel);
+NIO_API int channel_input(niochannel_t *channel, nioslice_t *slice);
+NIO_API int channel_consume(niochannel_t *channel, int len);
+
+/* returns: 1 = frame ready, 0 = need more input, -1 = invalid frame */
+NIO_API int channel_readframe(niochannel_t *channel,
+                              const nioframing_t *framing, nioslice_t *frame);
+NIO_API int channel_writeframe(niochannel_t *channel,
+                               const nioframing_t *framing, const void *data,
+                               int len);
+
+/* returns: 1 = record ready, 0 = need more input, -1 = record too long */
+NIO_API int channel_readrecord(niochannel_t *channel,
+                               const niodelimiter_t *delimiter,
+                               nioslice_t *record);
+
+/* corked output is flushed on uncork, when selector_select is entered and
+ * after its timers and tasks ran, needs a monitor, destroying the monitor
+ * or its selector uncorks */
+NIO_API int channel_cork(niochannel_t *channel, int on);
+NIO_API int channel_corked(niochannel_t *channel);
+
+/* returns: number of channels that failed */
+NIO_API int nio_fanout(niochannel_t **channels, int count, niobuffer_t *buffer);
+
 #ifdef __cplusplus
 };
 #endif
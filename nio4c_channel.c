@@ -0,0 +1,490 @@
+/*
+ *  nio4c_channel.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+#include <limits.h>
+#include <string.h>
+
+#define CHANNEL_IOVMAX 64
+#define CHANNEL_CHUNKSIZE 4096
+#define CHANNEL_READMIN 1024
+
+static niobuffer_t *buffer_new(int capacity) {
+  niobuffer_t *buffer;
+
+  if (capacity < 0)
+    return NULL;
+
+  buffer = (niobuffer_t *)nio_malloc(sizeof(niobuffer_t) + capacity);
+  if (!buffer)
+    return NULL;
+
+  buffer->refcount = 1;
+  buffer->size = 0;
+  buffer->capacity = capacity;
+
+  return buffer;
+}
+
+niobuffer_t *nio_buffer(const void *data, int len) {
+  niobuffer_t *buffer = buffer_new(len);
+  if (!buffer)
+    return NULL;
+
+  buffer->size = len;
+
+  if (data && len > 0)
+    memcpy(niobuffer_data(buffer), data, len);
+
+  return buffer;
+}
+
+niobuffer_t *buffer_retain(niobuffer_t *buffer) {
+  nio_atomicretain(&buffer->refcount);
+  return buffer;
+}
+
+void buffer_release(niobuffer_t *buffer) {
+  if (!buffer)
+    return;
+
+  if (nio_atomicrelease(&buffer->refcount) <= 0)
+    nio_free(buffer);
+}
+
+void *buffer_data(niobuffer_t *buffer) { return niobuffer_data(buffer); }
+
+int buffer_size(niobuffer_t *buffer) { return buffer->size; }
+
+niochannel_t *nio_channel(niosocket_t *io, niomonitor_t *monitor) {
+  niochannel_t *channel = (niochannel_t *)nio_malloc(sizeof(niochannel_t));
+  if (!channel)
+    return NULL;
+
+  channel->io = io;
+  channel->monitor = monitor;
+  channel->head = NULL;
+  channel->tail = NULL;
+  channel->pending = 0;
+  channel->writeinterest = 0;
+  channel->error = 0;
+  channel->input = NULL;
+  channel->incap = 0;
+  channel->inhead = 0;
+  channel->intail = 0;
+  channel->inwant = 0;
+  channel->inscanned = 0;
+  channel->corked = 0;
+  channel->corklinked = 0;
+  channel->corkprev = NULL;
+  channel->corknext = NULL;
+
+  if (monitor)
+    monitor->channel = channel;
+
+  return channel;
+}
+
+static void channel_clearoutput(niochannel_t *channel) {
+  niooutput_t *output;
+
+  while (channel->head) {
+    output = channel->head;
+    channel->head = output->next;
+
+    buffer_release(output->buffer);
+    nio_free(output);
+  }
+  channel->tail = NULL;
+  channel->pending = 0;
+}
+
+static void channel_linkcorked(niochannel_t *channel) {
+  nioselector_t *selector;
+
+  if (channel->corklinked || !channel->monitor)
+    return;
+
+  selector = channel->monitor->selector;
+
+  channel->corkprev = NULL;
+  channel->corknext = selector->corked;
+
+  if (selector->corked)
+    selector->corked->corkprev = channel;
+
+  selector->corked = channel;
+  channel->corklinked = 1;
+}
+
+static void channel_unlinkcorked(niochannel_t *channel) {
+  nioselector_t *selector;
+
+  if (!channel->corklinked)
+    return;
+
+  selector = channel->monitor->selector;
+
+  if (channel->corkprev)
+    channel->corkprev->corknext = channel->corknext;
+  else
+    selector->corked = channel->corknext;
+
+  if (channel->corknext)
+    channel->corknext->corkprev = channel->corkprev;
+
+  channel->corkprev = NULL;
+  channel->corknext = NULL;
+  channel->corklinked = 0;
+}
+
+void channel_flushcorked(nioselector_t *selector) {
+  niochannel_t *channel;
+
+  while (selector->corked) {
+    channel = selector->corked;
+    channel_unlinkcorked(channel);
+    channel_flush(channel);
+  }
+}
+
+void channel_dropcorked(nioselector_t *selector) {
+  while (selector->corked)
+    channel_unlinkcorked(selector->corked);
+}
+
+void channel_detach(niochannel_t *channel) {
+  channel_unlinkcorked(channel);
+
+  /* selector_select would never flush it, leave that to channel_flush */
+  channel->corked = 0;
+  channel->writeinterest = 0;
+
+  if (channel->monitor && channel == channel->monitor->channel)
+    channel->monitor->channel = NULL;
+  channel->monitor = NULL;
+}
+
+niosocket_t *channel_io(niochannel_t *channel) { return channel->io; }
+
+niomonitor_t *channel_monitor(niochannel_t *channel) {
+  return channel->monitor;
+}
+
+static void channel_writeinterest(niochannel_t *channel, int on) {
+  niomonitor_t *monitor = channel->monitor;
+
+  if (!monitor || monitor_closed(monitor))
+    return;
+
+  if (on) {
+    /* only take over NIO_WRITE if the user did not ask for it */
+    if (channel->writeinterest ||
+        NIO_WRITE == (monitor_getinterests(monitor) & NIO_WRITE))
+      return;
+
+    monitor_addinterest(monitor, NIO_WRITE);
+    channel->writeinterest = 1;
+  } else if (channel->writeinterest) {
+    monitor_removeinterest(monitor, NIO_WRITE);
+    channel->writeinterest = 0;
+  }
+}
+
+void channel_destroy(niochannel_t *channel) {
+  channel_writeinterest(channel, 0);
+  channel_detach(channel);
+  channel_clearoutput(channel);
+
+  if (channel->input)
+    nio_free(channel->input);
+
+  nio_free(channel);
+}
+
+static int channel_enqueue(niochannel_t *channel, niobuffer_t *buffer,
+                           int offset) {
+  niooutput_t *output = (niooutput_t *)nio_malloc(sizeof(niooutput_t));
+  if (!output)
+    return -1;
+
+  output->buffer = buffer_retain(buffer);
+  output->offset = offset;
+  output->next = NULL;
+
+  if (channel->tail)
+    channel->tail->next = output;
+  else
+    channel->head = output;
+
+  channel->tail = output;
+  channel->pending += buffer->size - offset;
+
+  if (channel->corked)
+    channel_linkcorked(channel);
+  else
+    channel_writeinterest(channel, 1);
+
+  return 0;
+}
+
+int channel_write(niochannel_t *channel, niobuffer_t *buffer) {
+  int sent = 0;
+
+  if (channel->error)
+    return -1;
+
+  if (buffer->size <= 0)
+    return 0;
+
+  /* opportunistic write, only when nothing is queued ahead of us */
+  if (!channel->corked && !channel->head) {
+    sent = nio_send(channel->io, niobuffer_data(buffer), buffer->size);
+
+    if (sent < 0) {
+      if (!nio_inprogress()) {
+        channel->error = 1;
+        return -1;
+      }
+      sent = 0;
+    }
+
+    if (sent == buffer->size)
+      return 0;
+  }
+
+  return channel_enqueue(channel, buffer, sent);
+}
+
+int channel_send(niochannel_t *channel, const void *data, int len) {
+  const unsigned char *lptr = (const unsigned char *)data;
+  niobuffer_t *buffer;
+  int sent = 0;
+
+  if (channel->error)
+    return -1;
+
+  if (len <= 0)
+    return 0;
+
+  if (!channel->corked && !channel->head) {
+    sent = nio_send(channel->io, lptr, len);
+
+    if (sent < 0) {
+      if (!nio_inprogress()) {
+        channel->error = 1;
+        return -1;
+      }
+      sent = 0;
+    }
+
+    if (sent == len)
+      return 0;
+
+    lptr += sent;
+    len -= sent;
+  }
+
+  /* coalesce into the tail chunk when nobody else shares it */
+  if (channel->tail) {
+    buffer = channel->tail->buffer;
+
+    if (1 == nio_atomicrefs(&buffer->refcount) &&
+        buffer->capacity - buffer->size >= len) {
+      memcpy(niobuffer_data(buffer) + buffer->size, lptr, len);
+      buffer->size += len;
+      channel->pending += len;
+      return 0;
+    }
+  }
+
+  buffer = buffer_new(len > CHANNEL_CHUNKSIZE ? len : CHANNEL_CHUNKSIZE);
+  if (!buffer)
+    return -1;
+
+  memcpy(niobuffer_data(buffer), lptr, len);
+  buffer->size = len;
+
+  if (0 != channel_enqueue(channel, buffer, 0)) {
+    buffer_release(buffer);
+    return -1;
+  }
+
+  buffer_release(buffer);
+  return 0;
+}
+
+int channel_flush(niochannel_t *channel) {
+  nioiobuf_t bufs[CHANNEL_IOVMAX];
+  niooutput_t *output;
+  int count, total, written, sent, remain;
+
+  if (channel->error)
+    return -1;
+
+  while (channel->head) {
+    total = 0;
+
+    for (count = 0, output = channel->head;
+         output && count < CHANNEL_IOVMAX; output = output->next, ++count) {
+      bufs[count].data = niobuffer_data(output->buffer) + output->offset;
+      bufs[count].len = output->buffer->size - output->offset;
+      total += bufs[count].len;
+    }
+
+    written = nio_sendv(channel->io, bufs, count);
+
+    if (written < 0) {
+      if (nio_inprogress())
+        break;
+
+      /* nothing will be written again, stop asking for NIO_WRITE */
+      channel->error = 1;
+      channel_writeinterest(channel, 0);
+      return -1;
+    }
+
+    channel->pending -= written;
+    sent = written;
+
+    while (sent > 0) {
+      output = channel->head;
+      remain = output->buffer->size - output->offset;
+
+      if (sent < remain) {
+        output->offset += sent;
+        break;
+      }
+
+      sent -= remain;
+      channel->head = output->next;
+
+      buffer_release(output->buffer);
+      nio_free(output);
+    }
+
+    if (!channel->head)
+      channel->tail = NULL;
+
+    /* socket buffer is full */
+    if (written < total)
+      break;
+  }
+
+  channel_writeinterest(channel, channel->head ? 1 : 0);
+  return channel->pending;
+}
+
+int channel_pending(niochannel_t *channel) {
+  return channel->error ? -1 : channel->pending;
+}
+
+static int channel_reserve(niochannel_t *channel, int size) {
+  unsigned char *input;
+  int used = channel->intail - channel->inhead;
+  unsigned long capacity;
+
+  if (channel->incap - channel->intail >= size)
+    return 0;
+
+  /* move the partial record to the front before growing */
+  if (channel->inhead > 0) {
+    memmove(channel->input, channel->input + channel->inhead, used);
+    channel->inhead = 0;
+    channel->intail = used;
+
+    if (channel->incap - channel->intail >= size)
+      return 0;
+  }
+
+  capacity = nio_nextpower((unsigned long)used + size);
+  if (capacity > INT_MAX)
+    return -1;
+
+  input = (unsigned char *)nio_realloc(channel->input, capacity);
+  if (!input)
+    return -1;
+
+  channel->input = input;
+  channel->incap = (int)capacity;
+
+  return 0;
+}
+
+int channel_read(niochannel_t *channel) {
+  int want = CHANNEL_READMIN;
+  int retval;
+
+  if (channel->inhead == channel->intail)
+    channel->inhead = channel->intail = 0;
+
+  if (channel->inwant > want)
+    want = channel->inwant;
+
+  if (0 != channel_reserve(channel, want))
+    return -1;
+
+  retval = nio_recv(channel->io, channel->input + channel->intail,
+                    channel->incap - channel->intail);
+
+  if (retval > 0) {
+    channel->intail += retval;
+    channel->inwant -= retval;
+  }
+
+  return retval;
+}
+
+int channel_input(niochannel_t *channel, nioslice_t *slice) {
+  slice->data = channel->input + channel->inhead;
+  slice->len = channel->intail - channel->inhead;
+  return slice->len;
+}
+
+int channel_consume(niochannel_t *channel, int len) {
+  if (len < 0 || len > channel->intail - channel->inhead)
+    return -1;
+
+  channel->inhead += len;
+  channel->inscanned = 0;
+  return 0;
+}
+
+int channel_cork(niochannel_t *channel, int on) {
+  if (on) {
+    /* the flush in selector_select needs a selector */
+    if (!channel->monitor)
+      return -1;
+
+    channel->corked = 1;
+    return 0;
+  }
+
+  if (!channel->corked)
+    return 0;
+
+  channel->corked = 0;
+  channel_unlinkcorked(channel);
+
+  return channel_flush(channel) < 0 ? -1 : 0;
+}
+
+int channel_corked(niochannel_t *channel) { return channel->corked; }
+
+int nio_fanout(niochannel_t **channels, int count, niobuffer_t *buffer) {
+  int i, failed = 0;
+
+  for (i = 0; i < count; ++i)
+    if (0 != channel_write(channels[i], buffer))
+      failed += 1;
+
+  return failed;
+}
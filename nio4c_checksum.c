@@ -0,0 +1,383 @@
+/*
+ *  nio4c_checksum.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHECKSUM_SSE2 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__clang__) ||                                                     \
+     (defined(__GNUC__) &&                                                     \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#include <immintrin.h>
+#define CHECKSUM_AVX2 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CHECKSUM_NEON 1
+#endif
+
+/*
+ * The ones' complement sum is byte order independent (RFC 1071), so every
+ * implementation below adds native 32-bit words into a 64-bit accumulator
+ * and folds at the end. Folding a native sum yields exactly what the
+ * network order sum returns after htons.
+ */
+typedef unsigned long long csum_t;
+typedef csum_t (*checksum_func)(const unsigned char *, int, csum_t);
+typedef csum_t (*copychecksum_func)(unsigned char *, const unsigned char *,
+                                    int, csum_t);
+
+static unsigned short checksum_fold(csum_t acc) {
+  acc = (acc >> 32) + (acc & 0xFFFFFFFFULL);
+  acc = (acc >> 32) + (acc & 0xFFFFFFFFULL);
+  acc = (acc >> 16) + (acc & 0xFFFFULL);
+  acc = (acc >> 16) + (acc & 0xFFFFULL);
+  acc = (acc >> 16) + (acc & 0xFFFFULL);
+  return (unsigned short)acc;
+}
+
+static csum_t checksum_scalar(const unsigned char *octetptr, int len,
+                              csum_t acc) {
+  unsigned int w32;
+  unsigned short w16;
+
+  while (len >= 16) {
+    memcpy(&w32, octetptr, 4);
+    acc += w32;
+    memcpy(&w32, octetptr + 4, 4);
+    acc += w32;
+    memcpy(&w32, octetptr + 8, 4);
+    acc += w32;
+    memcpy(&w32, octetptr + 12, 4);
+    acc += w32;
+
+    octetptr += 16;
+    len -= 16;
+  }
+
+  while (len >= 4) {
+    memcpy(&w32, octetptr, 4);
+    acc += w32;
+
+    octetptr += 4;
+    len -= 4;
+  }
+
+  if (len >= 2) {
+    memcpy(&w16, octetptr, 2);
+    acc += w16;
+
+    octetptr += 2;
+    len -= 2;
+  }
+
+  if (len > 0) {
+    /* odd octet is padded with zero to a full word */
+    unsigned char pad[2];
+
+    pad[0] = *octetptr;
+    pad[1] = 0;
+
+    memcpy(&w16, pad, 2);
+    acc += w16;
+  }
+
+  return acc;
+}
+
+static csum_t copychecksum_scalar(unsigned char *dst,
+                                  const unsigned char *octetptr, int len,
+                                  csum_t acc) {
+  unsigned int w32;
+  unsigned short w16;
+
+  while (len >= 4) {
+    memcpy(&w32, octetptr, 4);
+    memcpy(dst, &w32, 4);
+    acc += w32;
+
+    octetptr += 4;
+    dst += 4;
+    len -= 4;
+  }
+
+  if (len >= 2) {
+    memcpy(&w16, octetptr, 2);
+    memcpy(dst, &w16, 2);
+    acc += w16;
+
+    octetptr += 2;
+    dst += 2;
+    len -= 2;
+  }
+
+  if (len > 0) {
+    unsigned char pad[2];
+
+    pad[0] = *dst = *octetptr;
+    pad[1] = 0;
+
+    memcpy(&w16, pad, 2);
+    acc += w16;
+  }
+
+  return acc;
+}
+
+#ifdef CHECKSUM_SSE2
+static csum_t checksum_sse2(const unsigned char *octetptr, int len,
+                            csum_t acc) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i sum0 = zero, sum1 = zero, v0, v1;
+  csum_t lanes[2];
+
+  while (len >= 32) {
+    v0 = _mm_loadu_si128((const __m128i *)octetptr);
+    v1 = _mm_loadu_si128((const __m128i *)(octetptr + 16));
+
+    sum0 = _mm_add_epi64(sum0, _mm_unpacklo_epi32(v0, zero));
+    sum1 = _mm_add_epi64(sum1, _mm_unpackhi_epi32(v0, zero));
+    sum0 = _mm_add_epi64(sum0, _mm_unpacklo_epi32(v1, zero));
+    sum1 = _mm_add_epi64(sum1, _mm_unpackhi_epi32(v1, zero));
+
+    octetptr += 32;
+    len -= 32;
+  }
+
+  _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(sum0, sum1));
+  acc += lanes[0];
+  acc += lanes[1];
+
+  return checksum_scalar(octetptr, len, acc);
+}
+
+static csum_t copychecksum_sse2(unsigned char *dst,
+                                const unsigned char *octetptr, int len,
+                                csum_t acc) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i sum0 = zero, sum1 = zero, v;
+  csum_t lanes[2];
+
+  while (len >= 16) {
+    v = _mm_loadu_si128((const __m128i *)octetptr);
+    _mm_storeu_si128((__m128i *)dst, v);
+
+    sum0 = _mm_add_epi64(sum0, _mm_unpacklo_epi32(v, zero));
+    sum1 = _mm_add_epi64(sum1, _mm_unpackhi_epi32(v, zero));
+
+    octetptr += 16;
+    dst += 16;
+    len -= 16;
+  }
+
+  _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(sum0, sum1));
+  acc += lanes[0];
+  acc += lanes[1];
+
+  return copychecksum_scalar(dst, octetptr, len, acc);
+}
+#endif
+
+#ifdef CHECKSUM_AVX2
+__attribute__((target("avx2"))) static csum_t
+checksum_avx2(const unsigned char *octetptr, int len, csum_t acc) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i sum0 = zero, sum1 = zero, v0, v1;
+  csum_t lanes[4];
+
+  while (len >= 64) {
+    v0 = _mm256_loadu_si256((const __m256i *)octetptr);
+    v1 = _mm256_loadu_si256((const __m256i *)(octetptr + 32));
+
+    sum0 = _mm256_add_epi64(sum0, _mm256_unpacklo_epi32(v0, zero));
+    sum1 = _mm256_add_epi64(sum1, _mm256_unpackhi_epi32(v0, zero));
+    sum0 = _mm256_add_epi64(sum0, _mm256_unpacklo_epi32(v1, zero));
+    sum1 = _mm256_add_epi64(sum1, _mm256_unpackhi_epi32(v1, zero));
+
+    octetptr += 64;
+    len -= 64;
+  }
+
+  _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(sum0, sum1));
+  acc += lanes[0];
+  acc += lanes[1];
+  acc += lanes[2];
+  acc += lanes[3];
+
+#ifdef CHECKSUM_SSE2
+  return checksum_sse2(octetptr, len, acc);
+#else
+  return checksum_scalar(octetptr, len, acc);
+#endif
+}
+
+__attribute__((target("avx2"))) static csum_t
+copychecksum_avx2(unsigned char *dst, const unsigned char *octetptr, int len,
+                  csum_t acc) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i sum0 = zero, sum1 = zero, v;
+  csum_t lanes[4];
+
+  while (len >= 32) {
+    v = _mm256_loadu_si256((const __m256i *)octetptr);
+    _mm256_storeu_si256((__m256i *)dst, v);
+
+    sum0 = _mm256_add_epi64(sum0, _mm256_unpacklo_epi32(v, zero));
+    sum1 = _mm256_add_epi64(sum1, _mm256_unpackhi_epi32(v, zero));
+
+    octetptr += 32;
+    dst += 32;
+    len -= 32;
+  }
+
+  _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(sum0, sum1));
+  acc += lanes[0];
+  acc += lanes[1];
+  acc += lanes[2];
+  acc += lanes[3];
+
+  return copychecksum_scalar(dst, octetptr, len, acc);
+}
+#endif
+
+#ifdef CHECKSUM_NEON
+static csum_t checksum_neon(const unsigned char *octetptr, int len,
+                            csum_t acc) {
+  uint64x2_t sum0 = vdupq_n_u64(0), sum1 = vdupq_n_u64(0);
+
+  while (len >= 32) {
+    sum0 = vpadalq_u32(sum0, vreinterpretq_u32_u8(vld1q_u8(octetptr)));
+    sum1 = vpadalq_u32(sum1, vreinterpretq_u32_u8(vld1q_u8(octetptr + 16)));
+
+    octetptr += 32;
+    len -= 32;
+  }
+
+  sum0 = vaddq_u64(sum0, sum1);
+  acc += vgetq_lane_u64(sum0, 0);
+  acc += vgetq_lane_u64(sum0, 1);
+
+  return checksum_scalar(octetptr, len, acc);
+}
+
+static csum_t copychecksum_neon(unsigned char *dst,
+                                const unsigned char *octetptr, int len,
+                                csum_t acc) {
+  uint64x2_t sum = vdupq_n_u64(0);
+  uint8x16_t v;
+
+  while (len >= 16) {
+    v = vld1q_u8(octetptr);
+    vst1q_u8(dst, v);
+    sum = vpadalq_u32(sum, vreinterpretq_u32_u8(v));
+
+    octetptr += 16;
+    dst += 16;
+    len -= 16;
+  }
+
+  acc += vgetq_lane_u64(sum, 0);
+  acc += vgetq_lane_u64(sum, 1);
+
+  return copychecksum_scalar(dst, octetptr, len, acc);
+}
+#endif
+
+static checksum_func checksum_impl = NULL;
+static copychecksum_func copychecksum_impl = NULL;
+
+static void checksum_resolve(void) {
+  checksum_func impl = checksum_scalar;
+  copychecksum_func copyimpl = copychecksum_scalar;
+
+#if defined(CHECKSUM_NEON)
+  impl = checksum_neon;
+  copyimpl = copychecksum_neon;
+#elif defined(CHECKSUM_SSE2)
+  impl = checksum_sse2;
+  copyimpl = copychecksum_sse2;
+#endif
+
+#ifdef CHECKSUM_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    impl = checksum_avx2;
+    copyimpl = copychecksum_avx2;
+  }
+#endif
+
+  copychecksum_impl = copyimpl;
+  checksum_impl = impl;
+}
+
+unsigned short nio_checksum(const void *buffer, int len) {
+  if (len <= 0)
+    return 0;
+
+  if (!checksum_impl)
+    checksum_resolve();
+
+  return checksum_fold(checksum_impl((const unsigned char *)buffer, len, 0));
+}
+
+unsigned short nio_checksumupdate(unsigned short sum, const void *oldbuf,
+                                  const void *newbuf, int len) {
+  const unsigned char *oldptr = (const unsigned char *)oldbuf;
+  const unsigned char *newptr = (const unsigned char *)newbuf;
+  unsigned short oldw, neww;
+  unsigned char pad[2];
+  csum_t acc = sum;
+
+  /* RFC 1624 eqn. 3 on the uncomplemented sum: S' = S + ~m + m' */
+  while (len >= 2) {
+    memcpy(&oldw, oldptr, 2);
+    memcpy(&neww, newptr, 2);
+    acc += (unsigned short)~oldw;
+    acc += neww;
+
+    oldptr += 2;
+    newptr += 2;
+    len -= 2;
+  }
+
+  if (len > 0) {
+    pad[1] = 0;
+
+    pad[0] = *oldptr;
+    memcpy(&oldw, pad, 2);
+
+    pad[0] = *newptr;
+    memcpy(&neww, pad, 2);
+
+    acc += (unsigned short)~oldw;
+    acc += neww;
+  }
+
+  return checksum_fold(acc);
+}
+
+unsigned short nio_copychecksum(void *dst, const void *src, int len) {
+  if (len <= 0)
+    return 0;
+
+  if (!copychecksum_impl)
+    checksum_resolve();
+
+  return checksum_fold(copychecksum_impl((unsigned char *)dst,
+                                         (const unsigned char *)src, len, 0));
+}
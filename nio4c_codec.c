@@ -0,0 +1,266 @@
+/*
+ *  nio4c_codec.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CODEC_SSE2 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CODEC_NEON 1
+#endif
+
+static int framing_valid(const nioframing_t *framing) {
+  if (2 != framing->lensize && 4 != framing->lensize && 8 != framing->lensize)
+    return 0;
+
+  if (NIO_BIGENDIAN != framing->byteorder &&
+      NIO_LILENDIAN != framing->byteorder)
+    return 0;
+
+  return framing->maxsize >= 0;
+}
+
+static uint64_t framing_decode(const nioframing_t *framing,
+                               const unsigned char *head) {
+  uint16_t len16;
+  uint32_t len32;
+  uint64_t len64;
+
+  switch (framing->lensize) {
+  case 2:
+    memcpy(&len16, head, sizeof(len16));
+    return (NIO_BIGENDIAN == framing->byteorder) ? NIO_BE16(len16)
+                                                 : NIO_LE16(len16);
+  case 4:
+    memcpy(&len32, head, sizeof(len32));
+    return (NIO_BIGENDIAN == framing->byteorder) ? NIO_BE32(len32)
+                                                 : NIO_LE32(len32);
+  default:
+    memcpy(&len64, head, sizeof(len64));
+    return (NIO_BIGENDIAN == framing->byteorder) ? NIO_BE64(len64)
+                                                 : NIO_LE64(len64);
+  }
+}
+
+static void framing_encode(const nioframing_t *framing, unsigned char *head,
+                           int len) {
+  uint16_t len16;
+  uint32_t len32;
+  uint64_t len64;
+
+  switch (framing->lensize) {
+  case 2:
+    len16 = (uint16_t)len;
+    len16 = (NIO_BIGENDIAN == framing->byteorder) ? NIO_BE16(len16)
+                                                  : NIO_LE16(len16);
+    memcpy(head, &len16, sizeof(len16));
+    break;
+  case 4:
+    len32 = (uint32_t)len;
+    len32 = (NIO_BIGENDIAN == framing->byteorder) ? NIO_BE32(len32)
+                                                  : NIO_LE32(len32);
+    memcpy(head, &len32, sizeof(len32));
+    break;
+  default:
+    len64 = (uint64_t)len;
+    len64 = (NIO_BIGENDIAN == framing->byteorder) ? NIO_BE64(len64)
+                                                  : NIO_LE64(len64);
+    memcpy(head, &len64, sizeof(len64));
+    break;
+  }
+}
+
+int channel_readframe(niochannel_t *channel, const nioframing_t *framing,
+                      nioslice_t *frame) {
+  const unsigned char *head;
+  uint64_t len;
+  int avail;
+
+  if (!framing_valid(framing))
+    return -1;
+
+  head = channel->input + channel->inhead;
+  avail = channel->intail - channel->inhead;
+
+  if (avail < framing->lensize) {
+    channel->inwant = framing->lensize - avail;
+    return 0;
+  }
+
+  len = framing_decode(framing, head);
+
+  if (len > (uint64_t)framing->maxsize ||
+      len > (uint64_t)(INT_MAX - framing->lensize))
+    return -1;
+
+  if ((uint64_t)avail < framing->lensize + len) {
+    /* let the next channel_read make room for the whole frame */
+    channel->inwant = framing->lensize + (int)len - avail;
+    return 0;
+  }
+
+  frame->data = head + framing->lensize;
+  frame->len = (int)len;
+
+  channel->inhead += framing->lensize + (int)len;
+  channel->inwant = 0;
+  channel->inscanned = 0;
+
+  return 1;
+}
+
+int channel_writeframe(niochannel_t *channel, const nioframing_t *framing,
+                       const void *data, int len) {
+  niobuffer_t *buffer;
+  int retval;
+
+  if (!framing_valid(framing))
+    return -1;
+
+  if (len < 0 || len > framing->maxsize || len > INT_MAX - framing->lensize)
+    return -1;
+
+  if (2 == framing->lensize && len > 0xFFFF)
+    return -1;
+
+  buffer = nio_buffer(NULL, framing->lensize + len);
+  if (!buffer)
+    return -1;
+
+  framing_encode(framing, niobuffer_data(buffer), len);
+  memcpy(niobuffer_data(buffer) + framing->lensize, data, len);
+
+  retval = channel_write(channel, buffer);
+  buffer_release(buffer);
+
+  return retval;
+}
+
+#ifdef CODEC_SSE2
+static int codec_ctz(unsigned int mask) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (int)index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+static const unsigned char *codec_findbyte(const unsigned char *ptr,
+                                           const unsigned char *end,
+                                           unsigned char c) {
+#if defined(CODEC_SSE2)
+  __m128i needle = _mm_set1_epi8((char)c);
+  unsigned int mask;
+
+  while (end - ptr >= 64) {
+    __m128i v0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)ptr), needle);
+    __m128i v1 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + 16)), needle);
+    __m128i v2 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + 32)), needle);
+    __m128i v3 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + 48)), needle);
+
+    if (_mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3)))) {
+      if ((mask = (unsigned int)_mm_movemask_epi8(v0)) != 0)
+        return ptr + codec_ctz(mask);
+      if ((mask = (unsigned int)_mm_movemask_epi8(v1)) != 0)
+        return ptr + 16 + codec_ctz(mask);
+      if ((mask = (unsigned int)_mm_movemask_epi8(v2)) != 0)
+        return ptr + 32 + codec_ctz(mask);
+      mask = (unsigned int)_mm_movemask_epi8(v3);
+      return ptr + 48 + codec_ctz(mask);
+    }
+    ptr += 64;
+  }
+
+  while (end - ptr >= 16) {
+    mask = (unsigned int)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)ptr), needle));
+    if (mask)
+      return ptr + codec_ctz(mask);
+    ptr += 16;
+  }
+#elif defined(CODEC_NEON)
+  uint8x16_t needle = vdupq_n_u8(c);
+
+  while (end - ptr >= 16) {
+    if (vmaxvq_u8(vceqq_u8(vld1q_u8(ptr), needle)))
+      break;
+    ptr += 16;
+  }
+#endif
+
+  if (ptr >= end)
+    return NULL;
+
+  return (const unsigned char *)memchr(ptr, c, end - ptr);
+}
+
+int channel_readrecord(niochannel_t *channel, const niodelimiter_t *delimiter,
+                       nioslice_t *record) {
+  const unsigned char *delim = (const unsigned char *)delimiter->delim;
+  const unsigned char *head, *end, *ptr;
+  int avail, len;
+
+  if (!delim || delimiter->len <= 0)
+    return -1;
+
+  head = channel->input + channel->inhead;
+  avail = channel->intail - channel->inhead;
+  end = head + avail;
+
+  /* resume after what earlier calls already scanned */
+  ptr = head + channel->inscanned;
+
+  while (end - ptr >= delimiter->len) {
+    ptr = codec_findbyte(ptr, end - (delimiter->len - 1), delim[0]);
+    if (!ptr)
+      break;
+
+    if (0 == memcmp(ptr + 1, delim + 1, delimiter->len - 1)) {
+      len = (int)(ptr - head);
+
+      if (len > delimiter->maxsize)
+        return -1;
+
+      record->data = head;
+      record->len = len;
+
+      channel->inhead += len + delimiter->len;
+      channel->inscanned = 0;
+
+      return 1;
+    }
+    ptr += 1;
+  }
+
+  /* no delimiter can start before here, so the record is at least this long */
+  channel->inscanned = avail >= delimiter->len ? avail - delimiter->len + 1 : 0;
+
+  if (channel->inscanned > delimiter->maxsize)
+    return -1;
+
+  return 0;
+}
@@ -0,0 +1,415 @@
+/*
+ *  nio4c_connect.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+#include <string.h>
+
+/* RFC 8305 section 5, recommended connection attempt delay */
+#define CONNECT_ATTEMPTDELAY 250
+/* RFC 8305 section 3, how long an A answer waits for the AAAA one */
+#define CONNECT_RESOLUTIONDELAY 50
+
+typedef struct nioattempt_s {
+  niosocket_t io;
+  niomonitor_t *monitor;
+  nioconnect_t *connect;
+} nioattempt_t;
+
+struct nioconnect_s {
+  nioselector_t *selector;
+  niotimer_t delay;
+  niotimer_t timeout;
+  niotask_t deliver;
+  nio_connectcallback callback;
+  void *ud;
+  niosockaddr_t *addrs;
+  nioattempt_t *attempts;
+  int capacity;
+  int count;
+  int next;
+  int active;
+  int winner;
+  int done;
+  int delivered;
+  int resolving;
+  nioconnect_t *linkprev;
+  nioconnect_t *linknext;
+};
+
+static void connect_release(nioconnect_t *connect) {
+  nioselector_t *selector = connect->selector;
+  int i;
+
+  /* late resolver callbacks still reference the operation */
+  if (connect->resolving > 0)
+    return;
+
+  if (connect->linkprev)
+    connect->linkprev->linknext = connect->linknext;
+  else
+    selector->connects = connect->linknext;
+
+  if (connect->linknext)
+    connect->linknext->linkprev = connect->linkprev;
+
+  for (i = 0; i < connect->count; ++i)
+    if (connect->attempts[i].monitor)
+      monitor_destroy(connect->attempts[i].monitor);
+
+  if (connect->attempts)
+    nio_free(connect->attempts);
+
+  if (connect->addrs)
+    nio_free(connect->addrs);
+
+  nio_free(connect);
+}
+
+static void connect_deliver(niotask_t *task, int cancel) {
+  nioconnect_t *connect = nio_entry(task, nioconnect_t, deliver);
+  nioattempt_t *winner = NULL;
+
+  if (connect->winner >= 0)
+    winner = &connect->attempts[connect->winner];
+
+  /* a destroyed selector fails the operation, ud may still own something */
+  if (cancel) {
+    if (winner)
+      nio_destroysocket(&winner->io);
+
+    winner = NULL;
+  }
+
+  if (winner)
+    connect->callback(connect->ud, &winner->io,
+                      &connect->addrs[connect->winner]);
+  else
+    connect->callback(connect->ud, NULL, NULL);
+
+  connect->delivered = 1;
+  connect_release(connect);
+}
+
+static void connect_finish(nioconnect_t *connect, nioattempt_t *winner) {
+  nioattempt_t *attempt;
+  int i;
+
+  connect->done = 1;
+  connect->winner = winner ? (int)(winner - connect->attempts) : -1;
+
+  selector_canceltimer(connect->selector, &connect->delay);
+  selector_canceltimer(connect->selector, &connect->timeout);
+
+  /* monitors are only freed once the current dispatch is over */
+  for (i = 0; i < connect->next; ++i) {
+    attempt = &connect->attempts[i];
+
+    if (attempt->monitor && !monitor_closed(attempt->monitor))
+      selector_deregister(connect->selector, &attempt->io);
+
+    if (attempt != winner)
+      nio_destroysocket(&attempt->io);
+  }
+
+  selector_post(connect->selector, &connect->deliver);
+}
+
+static void connect_drop(nioattempt_t *attempt) {
+  nioconnect_t *connect = attempt->connect;
+
+  if (attempt->monitor && !monitor_closed(attempt->monitor)) {
+    selector_deregister(connect->selector, &attempt->io);
+    connect->active -= 1;
+  }
+  nio_destroysocket(&attempt->io);
+}
+
+static int connect_handler(niomonitor_t *monitor);
+
+static int connect_launch(nioconnect_t *connect, nioattempt_t *attempt) {
+  const niosockaddr_t *addr = &connect->addrs[attempt - connect->attempts];
+
+  if (0 != nio_createtcp(&attempt->io, addr->saddr.ss_family))
+    return -1;
+
+  nio_socketnonblock(&attempt->io, 1);
+
+  if (0 == nio_connect(&attempt->io, addr)) {
+    connect_finish(connect, attempt);
+    return 0;
+  }
+
+  if (!nio_inprogress()) {
+    nio_destroysocket(&attempt->io);
+    return -1;
+  }
+
+  attempt->monitor =
+      selector_register(connect->selector, &attempt->io, NIO_WRITE, attempt);
+
+  if (!attempt->monitor) {
+    nio_destroysocket(&attempt->io);
+    return -1;
+  }
+
+  attempt->monitor->handler = connect_handler;
+  connect->active += 1;
+
+  return 0;
+}
+
+static void connect_next(nioconnect_t *connect) {
+  nioattempt_t *attempt;
+
+  while (!connect->done && connect->next < connect->count) {
+    attempt = &connect->attempts[connect->next];
+    connect->next += 1;
+
+    if (0 != connect_launch(connect, attempt))
+      continue;
+
+    /* stagger the next family instead of racing all of them at once */
+    if (!connect->done && connect->next < connect->count)
+      selector_addtimer(connect->selector, &connect->delay,
+                        CONNECT_ATTEMPTDELAY);
+    return;
+  }
+
+  /* a family still resolving may bring more addresses */
+  if (!connect->done && 0 == connect->active && 0 == connect->resolving)
+    connect_finish(connect, NULL);
+}
+
+static int connect_handler(niomonitor_t *monitor) {
+  nioattempt_t *attempt = (nioattempt_t *)monitor_userdata(monitor);
+  nioconnect_t *connect = attempt->connect;
+
+  if (connect->done)
+    return 0;
+
+  if (!monitor_exception(monitor) && 0 == nio_socketerror(&attempt->io)) {
+    connect_finish(connect, attempt);
+    return 0;
+  }
+
+  /* a failed attempt starts the next one right away */
+  connect_drop(attempt);
+  selector_canceltimer(connect->selector, &connect->delay);
+  connect_next(connect);
+
+  return 0;
+}
+
+static void connect_delayed(niotimer_t *timer) {
+  connect_next(nio_entry(timer, nioconnect_t, delay));
+}
+
+static void connect_timedout(niotimer_t *timer) {
+  connect_finish(nio_entry(timer, nioconnect_t, timeout), NULL);
+}
+
+/* interleave address families, starting with the family listed first */
+static void connect_interleave(niosockaddr_t *dst, const niosockaddr_t *src,
+                               int count) {
+  int n = 0, a = 0, b = 0;
+  int first = src[0].saddr.ss_family;
+
+  while (n < count) {
+    while (a < count && src[a].saddr.ss_family != first)
+      a += 1;
+    if (a < count)
+      dst[n++] = src[a++];
+
+    while (b < count && src[b].saddr.ss_family == first)
+      b += 1;
+    if (b < count)
+      dst[n++] = src[b++];
+  }
+}
+
+static void connect_append(nioconnect_t *connect, const niosockaddr_t *addrs,
+                           int count) {
+  nio_dynarray(niosockaddr_t, pending, NIO_RESOLVEMAX * 2);
+  int remaining = connect->count - connect->next;
+
+  if (count > connect->capacity - connect->count)
+    count = connect->capacity - connect->count;
+
+  if (count <= 0)
+    return;
+
+  if (0 == remaining)
+    connect_interleave(connect->addrs + connect->count, addrs, count);
+  else {
+    /* a late family only ever follows attempts of the other one */
+    memcpy(pending, addrs, count * sizeof(niosockaddr_t));
+    memcpy(pending + count, connect->addrs + connect->next,
+           remaining * sizeof(niosockaddr_t));
+    connect_interleave(connect->addrs + connect->next, pending,
+                       count + remaining);
+  }
+
+  connect->count += count;
+}
+
+static nioconnect_t *connect_new(nioselector_t *selector, int capacity,
+                                 unsigned int timeout,
+                                 nio_connectcallback callback, void *ud) {
+  nioconnect_t *connect;
+  int i;
+
+  connect = (nioconnect_t *)nio_calloc(1, sizeof(nioconnect_t));
+  if (!connect)
+    return NULL;
+
+  if (capacity > 0) {
+    connect->addrs =
+        (niosockaddr_t *)nio_malloc(capacity * sizeof(niosockaddr_t));
+    connect->attempts =
+        (nioattempt_t *)nio_calloc(capacity, sizeof(nioattempt_t));
+
+    if (!connect->addrs || !connect->attempts) {
+      if (connect->addrs)
+        nio_free(connect->addrs);
+      if (connect->attempts)
+        nio_free(connect->attempts);
+
+      nio_free(connect);
+      return NULL;
+    }
+
+    for (i = 0; i < capacity; ++i) {
+      nio_initsocket(&connect->attempts[i].io);
+      connect->attempts[i].connect = connect;
+    }
+  }
+
+  connect->selector = selector;
+  connect->callback = callback;
+  connect->ud = ud;
+  connect->capacity = capacity;
+  connect->winner = -1;
+  connect->deliver.run = connect_deliver;
+
+  niotimer_init(&connect->delay, connect_delayed);
+  niotimer_init(&connect->timeout, connect_timedout);
+
+  if (timeout > 0)
+    selector_addtimer(selector, &connect->timeout, timeout);
+
+  /* selector_destroy fails whatever is still on this list */
+  connect->linknext = selector->connects;
+  if (selector->connects)
+    selector->connects->linkprev = connect;
+  selector->connects = connect;
+
+  return connect;
+}
+
+void connect_cancelall(nioselector_t *selector) {
+  nioconnect_t *connect;
+
+  /* the deliver tasks are run cancelled and release the operations */
+  for (connect = selector->connects; connect; connect = connect->linknext)
+    if (!connect->done)
+      connect_finish(connect, NULL);
+}
+
+int selector_connect(nioselector_t *selector, const niosockaddr_t *addrs,
+                     int count, unsigned int timeout,
+                     nio_connectcallback callback, void *ud) {
+  nioconnect_t *connect;
+
+  if (!callback || selector_closed(selector))
+    return -1;
+
+  connect = connect_new(selector, count, timeout, callback, ud);
+  if (!connect)
+    return -1;
+
+  connect_append(connect, addrs, count);
+  connect_next(connect);
+
+  return 0;
+}
+
+static void connect_resolved(nioconnect_t *connect, int af,
+                             const niosockaddr_t *addrs, int count) {
+  connect->resolving -= 1;
+
+  if (connect->done) {
+    if (connect->delivered)
+      connect_release(connect);
+    return;
+  }
+
+  connect_append(connect, addrs, count);
+
+  if (connect->next > 0) {
+    /* racing already, the new family joins after the attempt delay */
+    if (0 == connect->active)
+      connect_next(connect);
+    else if (!selector_timeractive(&connect->delay))
+      selector_addtimer(connect->selector, &connect->delay,
+                        CONNECT_ATTEMPTDELAY);
+    return;
+  }
+
+  /* IPv6 first as preferred by RFC 6724, but A does not wait long */
+  if (AF_INET == af && connect->resolving > 0) {
+    if (connect->count > 0 && !selector_timeractive(&connect->delay))
+      selector_addtimer(connect->selector, &connect->delay,
+                        CONNECT_RESOLUTIONDELAY);
+    return;
+  }
+
+  selector_canceltimer(connect->selector, &connect->delay);
+  connect_next(connect);
+}
+
+static void connect_resolved6(void *ud, const niosockaddr_t *addrs,
+                              int count) {
+  connect_resolved((nioconnect_t *)ud, AF_INET6, addrs, count);
+}
+
+static void connect_resolved4(void *ud, const niosockaddr_t *addrs,
+                              int count) {
+  connect_resolved((nioconnect_t *)ud, AF_INET, addrs, count);
+}
+
+int selector_connecthost(nioselector_t *selector, const char *hostname,
+                         unsigned short port, unsigned int timeout,
+                         nio_connectcallback callback, void *ud) {
+  nioconnect_t *connect;
+
+  if (!callback || !hostname || selector_closed(selector))
+    return -1;
+
+  connect = connect_new(selector, NIO_RESOLVEMAX * 2, timeout, callback, ud);
+  if (!connect)
+    return -1;
+
+  /* each family starts racing as soon as its own answer is in */
+  connect->resolving = 2;
+
+  if (0 != selector_resolve(selector, hostname, port, AF_INET6,
+                            connect_resolved6, connect))
+    connect->resolving -= 1;
+
+  if (0 != selector_resolve(selector, hostname, port, AF_INET,
+                            connect_resolved4, connect))
+    connect->resolving -= 1;
+
+  if (0 == connect->resolving)
+    connect_next(connect);
+
+  return 0;
+}
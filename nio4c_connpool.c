@@ -0,0 +1,317 @@
+/*
+ *  nio4c_connpool.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+#include <string.h>
+
+#define CONNPOOL_BUCKETS 256
+
+typedef struct nioconnhost_s nioconnhost_t;
+typedef struct nioconnidle_s nioconnidle_t;
+
+struct nioconnidle_s {
+  niosocket_t io;
+  niomonitor_t *monitor;
+  nioconnpool_t *pool;
+  nioconnhost_t *host;
+  niotimer_t timer;
+  nioconnidle_t *prev; /* per host, most recently released first */
+  nioconnidle_t *next;
+  nioconnidle_t *older; /* pool wide, for maxidle eviction */
+  nioconnidle_t *newer;
+};
+
+struct nioconnhost_s {
+  niosockaddr_t addr;
+  unsigned int hash;
+  int count;
+  nioconnidle_t *head;
+  nioconnidle_t *tail;
+  nioconnhost_t *next;
+};
+
+struct nioconnpool_s {
+  nioselector_t *selector;
+  int maxidle;
+  int maxperhost;
+  unsigned int idletimeout;
+  int count;
+  nioconnidle_t *oldest;
+  nioconnidle_t *newest;
+  nioconnhost_t *buckets[CONNPOOL_BUCKETS];
+};
+
+static unsigned int connpool_hash(const niosockaddr_t *addr) {
+  const unsigned char *octets;
+  unsigned int hash = 2166136261U;
+  unsigned short port;
+  int i, len;
+
+  if (AF_INET == addr->saddr.ss_family) {
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)&addr->saddr;
+    octets = (const unsigned char *)&a4->sin_addr;
+    len = sizeof(a4->sin_addr);
+    port = a4->sin_port;
+  } else if (AF_INET6 == addr->saddr.ss_family) {
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)&addr->saddr;
+    octets = (const unsigned char *)&a6->sin6_addr;
+    len = sizeof(a6->sin6_addr);
+    port = a6->sin6_port;
+#ifndef _WIN32
+  } else if (AF_UNIX == addr->saddr.ss_family) {
+    /* same span nio_sockaddrequal compares, the tail may be garbage */
+    octets = (const unsigned char *)&addr->saddr;
+    len = nio_sockaddrlen(&addr->saddr);
+    port = 0;
+#endif
+  } else
+    return 0;
+
+  /* FNV-1a over the fields nio_sockaddrequal compares */
+  for (i = 0; i < len; ++i) {
+    hash ^= octets[i];
+    hash *= 16777619U;
+  }
+
+  hash ^= port;
+  hash *= 16777619U;
+
+  return hash;
+}
+
+static nioconnhost_t *connpool_host(nioconnpool_t *pool,
+                                    const niosockaddr_t *addr, int create) {
+  unsigned int hash = connpool_hash(addr);
+  nioconnhost_t *host = pool->buckets[hash % CONNPOOL_BUCKETS];
+
+  while (host) {
+    if (host->hash == hash && nio_sockaddrequal(&host->addr, addr))
+      return host;
+    host = host->next;
+  }
+
+  if (!create)
+    return NULL;
+
+  host = (nioconnhost_t *)nio_calloc(1, sizeof(nioconnhost_t));
+  if (!host)
+    return NULL;
+
+  memcpy(&host->addr, addr, sizeof(niosockaddr_t));
+  host->hash = hash;
+
+  host->next = pool->buckets[hash % CONNPOOL_BUCKETS];
+  pool->buckets[hash % CONNPOOL_BUCKETS] = host;
+
+  return host;
+}
+
+static void connpool_freehost(nioconnpool_t *pool, nioconnhost_t *host) {
+  nioconnhost_t **link = &pool->buckets[host->hash % CONNPOOL_BUCKETS];
+
+  while (*link != host)
+    link = &(*link)->next;
+
+  *link = host->next;
+  nio_free(host);
+}
+
+/* the host goes with its last idle connection */
+static void connpool_unlink(nioconnidle_t *idle) {
+  nioconnpool_t *pool = idle->pool;
+  nioconnhost_t *host = idle->host;
+
+  if (idle->prev)
+    idle->prev->next = idle->next;
+  else
+    host->head = idle->next;
+
+  if (idle->next)
+    idle->next->prev = idle->prev;
+  else
+    host->tail = idle->prev;
+
+  if (idle->older)
+    idle->older->newer = idle->newer;
+  else
+    pool->oldest = idle->newer;
+
+  if (idle->newer)
+    idle->newer->older = idle->older;
+  else
+    pool->newest = idle->older;
+
+  host->count -= 1;
+  pool->count -= 1;
+
+  if (0 == host->count)
+    connpool_freehost(pool, host);
+
+  selector_canceltimer(pool->selector, &idle->timer);
+
+  /* handlers never look at their monitor again once they return */
+  selector_deregister(pool->selector, &idle->io);
+  monitor_destroy(idle->monitor);
+}
+
+static void connpool_close(nioconnidle_t *idle) {
+  connpool_unlink(idle);
+  nio_destroysocket(&idle->io);
+  nio_free(idle);
+}
+
+static int connpool_handler(niomonitor_t *monitor) {
+  /* an idle connection has nothing to read, data means close or garbage */
+  connpool_close((nioconnidle_t *)monitor_userdata(monitor));
+  return 0;
+}
+
+static void connpool_expired(niotimer_t *timer) {
+  connpool_close(nio_entry(timer, nioconnidle_t, timer));
+}
+
+static int connpool_alive(niosocket_t *s) {
+#ifndef _WIN32
+  char octet;
+
+  /* catches a FIN that arrived after the last selector_select */
+  if (recv(nio_sockfd(s), &octet, 1, MSG_PEEK | MSG_DONTWAIT) >= 0)
+    return 0;
+
+  return (EAGAIN == errno || EWOULDBLOCK == errno);
+#else
+  (void)s;
+  return 1;
+#endif
+}
+
+nioconnpool_t *nio_connpool(nioselector_t *selector, int maxidle,
+                            int maxperhost, unsigned int idletimeout) {
+  nioconnpool_t *pool;
+
+  pool = (nioconnpool_t *)nio_calloc(1, sizeof(nioconnpool_t));
+  if (!pool)
+    return NULL;
+
+  pool->selector = selector;
+  pool->maxidle = maxidle;
+  pool->maxperhost = maxperhost;
+  pool->idletimeout = idletimeout;
+
+  return pool;
+}
+
+void connpool_destroy(nioconnpool_t *pool) {
+  /* hosts are freed along with their last idle connection */
+  while (pool->oldest)
+    connpool_close(pool->oldest);
+
+  nio_free(pool);
+}
+
+int connpool_acquire(nioconnpool_t *pool, const niosockaddr_t *addr,
+                     niosocket_t *s) {
+  nioconnhost_t *host = connpool_host(pool, addr, 0);
+  nioconnidle_t *idle;
+
+  /* the warmest connection first, stale ones are dropped on the way */
+  while (host) {
+    idle = host->head;
+
+    if (idle == host->tail)
+      host = NULL;
+
+    connpool_unlink(idle);
+
+    if (connpool_alive(&idle->io)) {
+      *s = idle->io;
+      nio_free(idle);
+      return 1;
+    }
+
+    nio_destroysocket(&idle->io);
+    nio_free(idle);
+  }
+
+  return 0;
+}
+
+int connpool_release(nioconnpool_t *pool, const niosockaddr_t *addr,
+                     niosocket_t *s) {
+  nioconnhost_t *host = NULL;
+  nioconnidle_t *idle;
+
+  if (INVALID_SOCKET == nio_sockfd(s))
+    return -1;
+
+  if (pool->maxidle <= 0 || pool->maxperhost <= 0)
+    goto discard;
+
+  /* evict first, either may free the host */
+  host = connpool_host(pool, addr, 0);
+  if (host && host->count >= pool->maxperhost)
+    connpool_close(host->tail);
+
+  if (pool->count >= pool->maxidle)
+    connpool_close(pool->oldest);
+
+  host = connpool_host(pool, addr, 1);
+  if (!host)
+    goto discard;
+
+  idle = (nioconnidle_t *)nio_calloc(1, sizeof(nioconnidle_t));
+  if (!idle)
+    goto discard;
+
+  idle->io = *s;
+  idle->pool = pool;
+  idle->host = host;
+
+  idle->monitor = selector_register(pool->selector, &idle->io, NIO_READ, idle);
+  if (!idle->monitor) {
+    nio_free(idle);
+    goto discard;
+  }
+  idle->monitor->handler = connpool_handler;
+
+  niotimer_init(&idle->timer, connpool_expired);
+  if (pool->idletimeout > 0)
+    selector_addtimer(pool->selector, &idle->timer, pool->idletimeout);
+
+  idle->next = host->head;
+  if (host->head)
+    host->head->prev = idle;
+  else
+    host->tail = idle;
+  host->head = idle;
+
+  idle->older = pool->newest;
+  if (pool->newest)
+    pool->newest->newer = idle;
+  else
+    pool->oldest = idle;
+  pool->newest = idle;
+
+  host->count += 1;
+  pool->count += 1;
+
+  nio_initsocket(s);
+  return 0;
+
+discard:
+  if (host && 0 == host->count)
+    connpool_freehost(pool, host);
+
+  nio_destroysocket(s);
+  return -1;
+}
+
+int connpool_idle(nioconnpool_t *pool) { return pool->count; }
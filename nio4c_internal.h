@@ -14,6 +14,10 @@
 
 #include "nio4c.h"
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -33,6 +37,54 @@ void *nio_calloc(size_t count, size_t size);
 #endif
 
 unsigned long nio_nextpower(unsigned long size);
+unsigned long long nio_microtime(void);
+
+#if defined(_MSC_VER)
+#define nio_threadlocal __declspec(thread)
+#else
+#define nio_threadlocal __thread
+#endif
+
+#if defined(_MSC_VER)
+#define nio_atomicswap(p, v) InterlockedExchange((volatile LONG *)(p), (v))
+#define nio_atomicinc(p) InterlockedIncrement64((volatile LONG64 *)(p))
+#define nio_atomicload(p)                                                      \
+  InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0)
+#define nio_atomicretain(p) InterlockedIncrement((volatile LONG *)(p))
+#define nio_atomicrelease(p) InterlockedDecrement((volatile LONG *)(p))
+#define nio_atomicrefs(p) InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#else
+#define nio_atomicswap(p, v) __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL)
+#define nio_atomicinc(p) __atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+#define nio_atomicload(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define nio_atomicretain(p) __atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+#define nio_atomicrelease(p) __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL)
+#define nio_atomicrefs(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#endif
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION niomutex_t;
+typedef CONDITION_VARIABLE niocond_t;
+typedef HANDLE niothread_t;
+#else
+typedef pthread_mutex_t niomutex_t;
+typedef pthread_cond_t niocond_t;
+typedef pthread_t niothread_t;
+#endif
+
+int niomutex_init(niomutex_t *mutex);
+void niomutex_destroy(niomutex_t *mutex);
+void niomutex_lock(niomutex_t *mutex);
+void niomutex_unlock(niomutex_t *mutex);
+
+int niocond_init(niocond_t *cond);
+void niocond_destroy(niocond_t *cond);
+void niocond_wait(niocond_t *cond, niomutex_t *mutex);
+void niocond_signal(niocond_t *cond);
+void niocond_broadcast(niocond_t *cond);
+
+int niothread_create(niothread_t *thread, void (*func)(void *), void *arg);
+void niothread_join(niothread_t thread);
 
 extern nio_pollcreator nio_pollcreate;
 int nio_pollinit(nio_pollcreator creator);
@@ -80,27 +132,155 @@ int niohtable_iter(niohtable_t *ht, niohtableiter_t *iter);
 int niohtable_next(niohtableiter_t *iter, niosocket_t **io,
                    niomonitor_t **monitor);
 
+typedef struct nioiobuf_s {
+  const void *data;
+  int len;
+} nioiobuf_t;
+
+int nio_sendv(niosocket_t *s, const nioiobuf_t *bufs, int count);
+/* SO_BUSY_POLL and SO_PREFER_BUSY_POLL where the platform has them */
+int nio_sockbusypoll(niosocket_t *s, unsigned int usec);
+/* significant octets of the address, AF_UNIX stops at the end of the name */
+int nio_sockaddrlen(const struct sockaddr_storage *ss);
+
 #define NIO_IOERROR 4
+#define NIO_DISPATCH 8
+
+typedef struct niotask_s niotask_t;
+
+/* cancel is set when the selector is destroyed before the task ran */
+struct niotask_s {
+  void (*run)(niotask_t *task, int cancel);
+  niotask_t *next;
+};
+
+typedef struct niotimer_s niotimer_t;
+
+struct niotimer_s {
+  void (*run)(niotimer_t *timer);
+  unsigned long long expires;
+  int index;
+};
+
+typedef struct nioresolver_s nioresolver_t;
+typedef struct nioconnect_s nioconnect_t;
 
 struct nioselector_s {
   niopoll_t *selector;
   niohtable_t selectables;
   niosocket_t wakeup;
   niosocket_t waker;
+  niochannel_t *corked;
+  niomutex_t tasklock;
+  niotask_t *tasks;
+  niotask_t *tasktail;
+  niotimer_t **timers;
+  int ntimers;
+  int timercap;
+  nioresolver_t *resolver;
+  nioconnect_t *connects; /* selector_connect operations not yet delivered */
+  unsigned int busypoll;
+  int waking;           /* a wakeup octet is in flight */
+  niomonitor_t *buried; /* destroyed during selector_select, freed on return */
   int closed;
+#ifndef NIO_NOSTATS
+  nioselectorstats_t stats;
+  unsigned long long woken; /* when the last wait returned */
+  nioselectorlatency_t latency;
+  unsigned long long returned; /* when selector_select last returned */
+  unsigned long long stallthreshold;
+  nio_stallcallback stall;
+  void *stallud;
+#endif
 };
 
+#ifndef NIO_NOSTATS
+#define selector_count(selector, field) ((selector)->stats.field += 1)
+#else
+#define selector_count(selector, field) ((void)0)
+#endif
+
+void niolatency_record(nioselectorlatency_t *latency, unsigned long long usec);
+
+/* thread safe, tasks run on the selector thread inside selector_select */
+int selector_post(nioselector_t *selector, niotask_t *task);
+int selector_runtasks(nioselector_t *selector, int cancel);
+
+/* timers are owned by the caller and fire inside selector_select */
+void niotimer_init(niotimer_t *timer, void (*run)(niotimer_t *timer));
+int selector_addtimer(nioselector_t *selector, niotimer_t *timer,
+                      unsigned int millisec);
+void selector_canceltimer(nioselector_t *selector, niotimer_t *timer);
+int selector_timeractive(niotimer_t *timer);
+int selector_nexttimeout(nioselector_t *selector, int timeout);
+int selector_runtimers(nioselector_t *selector);
+
+void nioresolver_destroy(nioresolver_t *resolver);
+/* fails every pending connect, their callbacks see a NULL socket */
+void connect_cancelall(nioselector_t *selector);
+/* watchers still active when their selector goes away */
+void signal_unwatchall(nioselector_t *selector);
+
+/* returns non-zero to also report the monitor from selector_select */
+typedef int (*niomonitorhandler)(niomonitor_t *monitor);
+
 struct niomonitor_s {
   nioselector_t *selector;
   niosocket_t *io;
   void *ud;
+  niomonitorhandler handler;
   int interests;
   int readiness;
   int closed;
+  niomonitor_t *buried;
+  niochannel_t *channel;
 };
 
+struct niobuffer_s {
+  int refcount; /* atomic, buffers may be shared across threads */
+  int size;
+  int capacity;
+};
+
+#define niobuffer_data(b) ((unsigned char *)((b) + 1))
+
+typedef struct niooutput_s niooutput_t;
+
+struct niooutput_s {
+  niobuffer_t *buffer;
+  int offset;
+  niooutput_t *next;
+};
+
+struct niochannel_s {
+  niosocket_t *io;
+  niomonitor_t *monitor;
+  niooutput_t *head;
+  niooutput_t *tail;
+  int pending;
+  int writeinterest;
+  int error;
+  unsigned char *input;
+  int incap;
+  int inhead;
+  int intail;
+  int inwant;
+  int inscanned;
+  int corked;
+  int corklinked;
+  niochannel_t *corkprev;
+  niochannel_t *corknext;
+};
+
+void channel_flushcorked(nioselector_t *selector);
+void channel_dropcorked(nioselector_t *selector);
+/* the monitor or its selector is going away, forget both */
+void channel_detach(niochannel_t *channel);
+
 niomonitor_t *monitor_new(nioselector_t *selector, niosocket_t *io,
                           int interest, void *ud);
+/* returns 1 when the monitor must outlive the selector_select in progress */
+int selector_bury(niomonitor_t *monitor);
 int monitor_resetinterests(niomonitor_t *monitor);
 
 #ifdef __cplusplus
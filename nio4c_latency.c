@@ -0,0 +1,89 @@
+/*
+ *  nio4c_latency.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+
+#define LATENCY_SUBBITS 2
+#define LATENCY_SUBCOUNT (1 << LATENCY_SUBBITS)
+
+static int latency_log2(unsigned long long value) {
+  int bits = 0;
+
+  while (value >>= 1)
+    bits += 1;
+  return bits;
+}
+
+/* log2 major buckets split into 4 linear ones, within 25% of the value */
+static int latency_index(unsigned long long usec) {
+  int major, index;
+
+  if (usec < LATENCY_SUBCOUNT)
+    return (int)usec;
+
+  major = latency_log2(usec);
+  index = (major - LATENCY_SUBBITS + 1) * LATENCY_SUBCOUNT +
+          (int)((usec >> (major - LATENCY_SUBBITS)) & (LATENCY_SUBCOUNT - 1));
+
+  return index < NIO_LATENCYBUCKETS ? index : NIO_LATENCYBUCKETS - 1;
+}
+
+static unsigned long long latency_upper(int index) {
+  int shift;
+
+  if (index < LATENCY_SUBCOUNT)
+    return (unsigned long long)index;
+
+  shift = index / LATENCY_SUBCOUNT - 1;
+
+  return ((unsigned long long)(LATENCY_SUBCOUNT + index % LATENCY_SUBCOUNT)
+          << shift) +
+         (1ULL << shift) - 1;
+}
+
+void niolatency_record(nioselectorlatency_t *latency, unsigned long long usec) {
+  latency->count += 1;
+  latency->total += usec;
+
+  if (usec > latency->max)
+    latency->max = usec;
+
+  latency->buckets[latency_index(usec)] += 1;
+}
+
+unsigned long long nio_latencypercentile(const nioselectorlatency_t *latency,
+                                         double percentile) {
+  unsigned long long rank, seen = 0, upper;
+  int i;
+
+  if (0 == latency->count)
+    return 0;
+
+  if (percentile <= 0.0)
+    percentile = 0.0;
+  if (percentile >= 100.0)
+    return latency->max;
+
+  rank = (unsigned long long)(percentile / 100.0 * (double)latency->count);
+  if (rank < 1)
+    rank = 1;
+
+  for (i = 0; i < NIO_LATENCYBUCKETS; ++i) {
+    seen += latency->buckets[i];
+
+    if (seen >= rank) {
+      upper = latency_upper(i);
+      return upper < latency->max ? upper : latency->max;
+    }
+  }
+
+  return latency->max;
+}
@@ -0,0 +1,230 @@
+/*
+ *  nio4c_listener.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+
+#define LISTENER_BATCH 16
+#define LISTENER_MAXACCEPT 64
+#define LISTENER_MINBACKOFF 10
+#define LISTENER_MAXBACKOFF 1000
+
+#ifndef _WIN32
+#define listener_errno() errno
+#define listener_exhausted(e) (EMFILE == (e) || ENFILE == (e))
+#else
+#define listener_errno() WSAGetLastError()
+#define listener_exhausted(e) (WSAEMFILE == (e) || WSAENOBUFS == (e))
+#endif
+
+struct niolistener_s {
+  nioselector_t *selector;
+  niosocket_t io;
+  niomonitor_t *monitor;
+  niotimer_t timer;
+  niotask_t deliver;
+  nio_acceptcallback callback;
+  void *ud;
+  int maxaccept;
+  unsigned int backoff;
+  int reserve;
+  niosocket_t *clients; /* accepted, waiting for the deliver task */
+  niosockaddr_t *addrs;
+  int pending;
+  int posted;
+  int dispatching;
+  int destroyed;
+};
+
+static void listener_reserve(niolistener_t *listener) {
+#ifndef _WIN32
+  if (listener->reserve < 0)
+    listener->reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+#else
+  (void)listener;
+#endif
+}
+
+static void listener_shed(niolistener_t *listener) {
+#ifndef _WIN32
+  niosocket_t client;
+
+  if (listener->reserve < 0)
+    return;
+
+  /* free one descriptor so the pending peer gets a clean close, not a hang */
+  close(listener->reserve);
+  listener->reserve = -1;
+
+  if (0 == nio_accept(&listener->io, &client, NULL))
+    nio_destroysocket(&client);
+
+  listener_reserve(listener);
+#else
+  (void)listener;
+#endif
+}
+
+static void listener_resume(niotimer_t *timer) {
+  niolistener_t *listener = nio_entry(timer, niolistener_t, timer);
+  monitor_addinterest(listener->monitor, NIO_READ);
+}
+
+static void listener_pause(niolistener_t *listener) {
+  listener->backoff = listener->backoff ? listener->backoff * 2
+                                        : LISTENER_MINBACKOFF;
+  if (listener->backoff > LISTENER_MAXBACKOFF)
+    listener->backoff = LISTENER_MAXBACKOFF;
+
+  /* a level-triggered listener would spin until descriptors come back */
+  monitor_removeinterest(listener->monitor, NIO_READ);
+  selector_addtimer(listener->selector, &listener->timer, listener->backoff);
+}
+
+static void listener_free(niolistener_t *listener) {
+#ifndef _WIN32
+  if (listener->reserve >= 0)
+    close(listener->reserve);
+#endif
+  if (listener->monitor)
+    monitor_destroy(listener->monitor);
+  if (listener->clients)
+    nio_free(listener->clients);
+  if (listener->addrs)
+    nio_free(listener->addrs);
+  nio_free(listener);
+}
+
+static void listener_deliver(niotask_t *task, int cancel) {
+  niolistener_t *listener = nio_entry(task, niolistener_t, deliver);
+  int i;
+
+  listener->dispatching = 1;
+
+  /* the callback may destroy the listener, the rest are closed then */
+  for (i = 0; i < listener->pending; ++i) {
+    if (!cancel && !listener->destroyed)
+      listener->callback(listener->ud, &listener->clients[i],
+                         &listener->addrs[i]);
+    else
+      nio_destroysocket(&listener->clients[i]);
+  }
+
+  listener->pending = 0;
+  listener->posted = 0;
+  listener->dispatching = 0;
+
+  if (listener->destroyed)
+    listener_free(listener);
+}
+
+static int listener_handler(niomonitor_t *monitor) {
+  niolistener_t *listener = (niolistener_t *)monitor_userdata(monitor);
+  int accepted, err, total = listener->pending;
+
+  /* user code never runs inside a handler, it could free monitors the
+   * dispatch still holds, accepted clients go out through a task */
+  while (total < listener->maxaccept) {
+    accepted = listener->maxaccept - total;
+    if (accepted > LISTENER_BATCH)
+      accepted = LISTENER_BATCH;
+
+    accepted = nio_acceptmany(&listener->io, &listener->clients[total],
+                              &listener->addrs[total], accepted,
+                              NIO_SOCKNONBLOCK | NIO_SOCKCLOEXEC);
+
+    if (accepted < 0) {
+      err = listener_errno();
+
+      if (listener_exhausted(err)) {
+        listener_shed(listener);
+        listener_pause(listener);
+      }
+      break;
+    }
+
+    if (0 == accepted)
+      break;
+
+    listener->backoff = 0;
+    total += accepted;
+  }
+
+  listener->pending = total;
+
+  if (total > 0 && !listener->posted) {
+    listener->posted = 1;
+    selector_post(listener->selector, &listener->deliver);
+  }
+
+  return 0;
+}
+
+niolistener_t *nio_listener(nioselector_t *selector, niosocket_t *s,
+                            int maxaccept, nio_acceptcallback callback,
+                            void *ud) {
+  niolistener_t *listener;
+
+  if (!callback || selector_closed(selector))
+    return NULL;
+
+  listener = (niolistener_t *)nio_calloc(1, sizeof(niolistener_t));
+  if (!listener)
+    return NULL;
+
+  listener->selector = selector;
+  listener->io = *s;
+  listener->callback = callback;
+  listener->ud = ud;
+  listener->maxaccept = maxaccept > 0 ? maxaccept : LISTENER_MAXACCEPT;
+  listener->reserve = -1;
+  listener->deliver.run = listener_deliver;
+
+  listener->clients =
+      (niosocket_t *)nio_malloc(listener->maxaccept * sizeof(niosocket_t));
+  listener->addrs =
+      (niosockaddr_t *)nio_malloc(listener->maxaccept * sizeof(niosockaddr_t));
+
+  if (!listener->clients || !listener->addrs) {
+    listener_free(listener);
+    return NULL;
+  }
+
+  nio_socketnonblock(&listener->io, 1);
+  niotimer_init(&listener->timer, listener_resume);
+
+  listener->monitor =
+      selector_register(selector, &listener->io, NIO_READ, listener);
+
+  if (!listener->monitor) {
+    listener_free(listener);
+    return NULL;
+  }
+  listener->monitor->handler = listener_handler;
+
+  listener_reserve(listener);
+
+  return listener;
+}
+
+void listener_destroy(niolistener_t *listener) {
+  selector_canceltimer(listener->selector, &listener->timer);
+  selector_deregister(listener->selector, &listener->io);
+
+  /* a posted deliver task still owns the listener, it frees it */
+  if (listener->posted || listener->dispatching)
+    listener->destroyed = 1;
+  else
+    listener_free(listener);
+}
+
+int listener_paused(niolistener_t *listener) {
+  return selector_timeractive(&listener->timer);
+}
@@ -10,6 +10,7 @@
  */
 
 #include "nio4c_internal.h"
+#include "nio4c_probes.h"
 
 niomonitor_t *monitor_new(nioselector_t *selector, niosocket_t *io,
                           int interest, void *ud) {
@@ -20,17 +21,26 @@ niomonitor_t *monitor_new(nioselector_t *selector, niosocket_t *io,
   monitor->selector = selector;
   monitor->io = io;
   monitor->ud = ud;
+  monitor->handler = NULL;
   monitor->interests = interest;
   monitor->readiness = 0;
   monitor->closed = 0;
+  monitor->buried = NULL;
+  monitor->channel = NULL;
 
   return monitor;
 }
 
 void monitor_destroy(niomonitor_t *monitor) {
+  if (monitor->channel)
+    channel_detach(monitor->channel);
+
   if (!monitor_closed(monitor))
     monitor_close(monitor, 1);
-  nio_free(monitor);
+
+  /* the dispatch in progress may still hold a pointer to it */
+  if (!selector_bury(monitor))
+    nio_free(monitor);
 }
 
 void *monitor_userdata(niomonitor_t *monitor) { return monitor->ud; }
@@ -51,6 +61,10 @@ int monitor_close(niomonitor_t *monitor, int deregister) {
 int monitor_getinterests(niomonitor_t *monitor) { return monitor->interests; }
 
 int monitor_resetinterests(niomonitor_t *monitor) {
+  selector_count(monitor->selector, interestchanges);
+  NIO_PROBE3(interest, monitor->selector, nio_sockfd(monitor->io),
+             monitor->interests);
+
   return niopoll_ioevent(monitor->selector->selector, nio_sockfd(monitor->io),
                          NIO_READ == (monitor->interests & NIO_READ),
                          NIO_WRITE == (monitor->interests & NIO_WRITE),
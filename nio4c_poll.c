@@ -10,6 +10,7 @@
  */
 
 #include "nio4c_internal.h"
+#include <string.h>
 
 #if defined(__linux__)
 #include <sys/epoll.h>
@@ -102,7 +103,9 @@ static niopoll_t *nioepoll_create(void) {
 
   return &ep->np;
 }
-#elif defined(__APPLE__) || defined(__BSD__)
+#endif /* __linux__ */
+
+#if defined(__APPLE__) || defined(__BSD__)
 #include <errno.h>
 #include <string.h>
 #include <sys/event.h>
@@ -226,7 +229,9 @@ static niopoll_t *niokqueue_create(void) {
 
   return &kq->np;
 }
-#else
+#endif /* __APPLE__ || __BSD__ */
+
+/* select is the portable fallback and always built */
 #if defined(_WIN32)
 #include <WinSock2.h>
 #else
@@ -278,6 +283,12 @@ static int nioselect_register(niopoll_t *p, int fd, void *userdata) {
   if (sp->nfds >= FD_SETSIZE)
     return -1;
 
+#ifndef _WIN32
+  /* POSIX fd_set is a bitmap, descriptors past it can not be watched */
+  if (fd >= (int)(sizeof(fd_set) * 8))
+    return -1;
+#endif
+
   for (i = 0; i < sp->nfds; ++i)
     if (sp->sfds[i].fd == fd)
       return -1;
@@ -451,7 +462,175 @@ static niopoll_t *nioselect_create(void) {
 
   return &sp->np;
 }
-#endif
+
+#ifndef _WIN32
+#include <poll.h>
+
+#define POLL_INITSIZE 64
+
+/* descriptors without interest are stored complemented, poll skips them */
+#define poll_realfd(fd) ((fd) < 0 ? ~(fd) : (fd))
+
+typedef struct niopollfds_s {
+  niopoll_t np;
+  struct pollfd *fds;
+  void **uds;
+  int nfds;
+  int capacity;
+  int *slots; /* fd -> index in fds, -1 if not registered */
+  int nslots;
+} niopollfds_t;
+
+static const char *niopollfds_backend(niopoll_t *p) { return "poll"; }
+
+static void niopollfds_destroy(niopoll_t *p) {
+  niopollfds_t *pp = nio_entry(p, niopollfds_t, np);
+
+  if (pp->fds)
+    nio_free(pp->fds);
+  if (pp->uds)
+    nio_free(pp->uds);
+  if (pp->slots)
+    nio_free(pp->slots);
+  nio_free(pp);
+}
+
+static int niopollfds_slot(niopollfds_t *pp, int fd) {
+  if (fd < 0 || fd >= pp->nslots)
+    return -1;
+  return pp->slots[fd];
+}
+
+static int niopollfds_register(niopoll_t *p, int fd, void *userdata) {
+  niopollfds_t *pp = nio_entry(p, niopollfds_t, np);
+  struct pollfd *fds;
+  void **uds;
+  int *slots;
+  int i, size;
+
+  if (fd < 0 || niopollfds_slot(pp, fd) >= 0)
+    return -1;
+
+  if (fd >= pp->nslots) {
+    size = pp->nslots ? pp->nslots : POLL_INITSIZE;
+    while (size <= fd)
+      size *= 2;
+
+    slots = (int *)nio_realloc(pp->slots, size * sizeof(int));
+    if (!slots)
+      return -1;
+
+    for (i = pp->nslots; i < size; ++i)
+      slots[i] = -1;
+
+    pp->slots = slots;
+    pp->nslots = size;
+  }
+
+  if (pp->nfds >= pp->capacity) {
+    size = pp->capacity ? pp->capacity * 2 : POLL_INITSIZE;
+
+    fds = (struct pollfd *)nio_realloc(pp->fds, size * sizeof(struct pollfd));
+    if (!fds)
+      return -1;
+    pp->fds = fds;
+
+    uds = (void **)nio_realloc(pp->uds, size * sizeof(void *));
+    if (!uds)
+      return -1;
+    pp->uds = uds;
+
+    pp->capacity = size;
+  }
+
+  i = pp->nfds++;
+
+  pp->fds[i].fd = ~fd;
+  pp->fds[i].events = 0;
+  pp->fds[i].revents = 0;
+  pp->uds[i] = userdata;
+  pp->slots[fd] = i;
+
+  return 0;
+}
+
+static int niopollfds_deregister(niopoll_t *p, int fd) {
+  niopollfds_t *pp = nio_entry(p, niopollfds_t, np);
+  int i = niopollfds_slot(pp, fd), last;
+
+  if (i < 0)
+    return -1;
+
+  /* move the last entry into the hole */
+  last = --pp->nfds;
+
+  if (i != last) {
+    pp->fds[i] = pp->fds[last];
+    pp->uds[i] = pp->uds[last];
+    pp->slots[poll_realfd(pp->fds[i].fd)] = i;
+  }
+
+  pp->slots[fd] = -1;
+  return 0;
+}
+
+static int niopollfds_ioevent(niopoll_t *p, int fd, int readable,
+                              int writeable, void *userdata) {
+  niopollfds_t *pp = nio_entry(p, niopollfds_t, np);
+  int i = niopollfds_slot(pp, fd);
+
+  if (i < 0)
+    return -1;
+
+  pp->fds[i].events = (readable ? POLLIN : 0) | (writeable ? POLLOUT : 0);
+  pp->fds[i].fd = pp->fds[i].events ? fd : ~fd;
+  pp->uds[i] = userdata;
+
+  return 0;
+}
+
+static int niopollfds_wait(niopoll_t *p, nioevent_t *evt, int count,
+                           int timeout) {
+  niopollfds_t *pp = nio_entry(p, niopollfds_t, np);
+  int ready, i, j = 0;
+  short revents;
+
+  ready = poll(pp->fds, pp->nfds, timeout);
+
+  for (i = 0; i < pp->nfds && j < ready && j < count; ++i) {
+    revents = pp->fds[i].revents;
+
+    if (0 == revents || pp->fds[i].fd < 0)
+      continue;
+
+    evt[j].fd = pp->fds[i].fd;
+    evt[j].userdata = pp->uds[i];
+    evt[j].error = !!(revents & (POLLERR | POLLNVAL));
+    evt[j].readable = !!(revents & (POLLIN | POLLHUP));
+    evt[j].writeable = !!(revents & POLLOUT);
+
+    j += 1;
+  }
+
+  return j;
+}
+
+static niopoll_t *niopollfds_create(void) {
+  niopollfds_t *pp = (niopollfds_t *)nio_calloc(1, sizeof(niopollfds_t));
+
+  if (!pp)
+    return NULL;
+
+  pp->np.method_backend = niopollfds_backend;
+  pp->np.method_destroy = niopollfds_destroy;
+  pp->np.method_register = niopollfds_register;
+  pp->np.method_deregister = niopollfds_deregister;
+  pp->np.method_ioevent = niopollfds_ioevent;
+  pp->np.method_wait = niopollfds_wait;
+
+  return &pp->np;
+}
+#endif /* _WIN32 */
 
 nio_pollcreator nio_pollcreate = NULL;
 
@@ -471,3 +650,29 @@ int nio_pollinit(nio_pollcreator creator) {
 
   return nio_pollcreate ? 0 : -1;
 }
+
+nio_pollcreator nio_pollbackend(const char *name) {
+  if (!name)
+    return NULL;
+
+#if defined(__linux__)
+  if (0 == strcmp(name, "epoll"))
+    return nioepoll_create;
+#endif
+
+#if defined(__APPLE__) || defined(__BSD__)
+  if (0 == strcmp(name, "kqueue"))
+    return niokqueue_create;
+#endif
+
+#ifndef _WIN32
+  if (0 == strcmp(name, "poll"))
+    return niopollfds_create;
+#endif
+
+  if (0 == strcmp(name, "select"))
+    return nioselect_create;
+
+  /* unknown or not built here, e.g. "io_uring" */
+  return NULL;
+}
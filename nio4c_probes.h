@@ -0,0 +1,46 @@
+/*
+ *  nio4c_probes.h
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#ifndef __NIO4C_PROBES_H__
+#define __NIO4C_PROBES_H__
+
+/* USDT probes under the "nio4c" provider, build with NIO_USDT and
+ * sys/sdt.h (systemtap-sdt-dev) to get them, e.g.
+ *   bpftrace -e 'usdt:./libnio4c.so:nio4c:recv { @[arg0] = sum(arg1); }'
+ * a disabled probe site is a single nop, without NIO_USDT nothing at all
+ *
+ *   select_entry    (selector, timeout ms)
+ *   select_return   (selector, backend events, monitors reported)
+ *   event           (selector, fd, readable, writeable, error)
+ *   register        (selector, fd, interests)
+ *   deregister      (selector, fd)
+ *   interest        (selector, fd, interests), every register is followed
+ *                   by one arming the initial interests
+ *   accept          (listener fd, client fd or -1)
+ *   connect         (fd, result)
+ *   send / recv     (fd, octets or -1), fd passing included, fast open
+ *                   fires connect then send for its single syscall
+ */
+
+#if defined(NIO_USDT) && !defined(_WIN32)
+#include <sys/sdt.h>
+
+#define NIO_PROBE2(name, a, b) DTRACE_PROBE2(nio4c, name, a, b)
+#define NIO_PROBE3(name, a, b, c) DTRACE_PROBE3(nio4c, name, a, b, c)
+#define NIO_PROBE5(name, a, b, c, d, e)                                        \
+  DTRACE_PROBE5(nio4c, name, a, b, c, d, e)
+#else
+#define NIO_PROBE2(name, a, b) ((void)0)
+#define NIO_PROBE3(name, a, b, c) ((void)0)
+#define NIO_PROBE5(name, a, b, c, d, e) ((void)0)
+#endif
+
+#endif /* __NIO4C_PROBES_H__ */
@@ -0,0 +1,403 @@
+/*
+ *  nio4c_resolver.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+#include <string.h>
+
+#define RESOLVER_WORKERS 2
+#define RESOLVER_BUCKETS 64
+#define RESOLVER_POSITIVETTL 60000
+#define RESOLVER_NEGATIVETTL 5000
+
+typedef struct nioresolvewaiter_s nioresolvewaiter_t;
+typedef struct nioresolveentry_s nioresolveentry_t;
+
+struct nioresolvewaiter_s {
+  nio_resolvecallback callback;
+  void *ud;
+  unsigned short port;
+  nioresolvewaiter_t *next;
+};
+
+struct nioresolveentry_s {
+  niotask_t task;
+  nioresolver_t *resolver;
+  char *hostname;
+  int af;
+  unsigned int hash;
+  int pending;
+  unsigned long long expires;
+  niosockaddr_t addrs[NIO_RESOLVEMAX];
+  int count;
+  nioresolvewaiter_t *waiters;
+  nioresolveentry_t *next;
+  nioresolveentry_t *jobnext;
+};
+
+/* cache hits and passive addresses are delivered through the selector too */
+typedef struct nioresolvehit_s {
+  niotask_t task;
+  nio_resolvecallback callback;
+  void *ud;
+  niosockaddr_t addrs[NIO_RESOLVEMAX];
+  int count;
+} nioresolvehit_t;
+
+struct nioresolver_s {
+  nioselector_t *selector;
+  niomutex_t lock;
+  niocond_t cond;
+  nioresolveentry_t *jobs;
+  nioresolveentry_t *jobtail;
+  niothread_t workers[RESOLVER_WORKERS];
+  int nworkers;
+  int stop;
+  unsigned int positivettl;
+  unsigned int negativettl;
+  nioresolveentry_t *buckets[RESOLVER_BUCKETS];
+};
+
+static unsigned int resolver_hash(const char *hostname, int af) {
+  /* FNV-1a */
+  unsigned int hash = 2166136261U;
+
+  while (*hostname) {
+    hash ^= (unsigned char)*hostname++;
+    hash *= 16777619U;
+  }
+  return hash ^ (unsigned int)af;
+}
+
+static void resolver_setport(niosockaddr_t *addrs, int count,
+                             unsigned short port) {
+  int i;
+
+  for (i = 0; i < count; ++i) {
+    if (AF_INET == addrs[i].saddr.ss_family)
+      ((struct sockaddr_in *)&addrs[i].saddr)->sin_port = htons(port);
+    else if (AF_INET6 == addrs[i].saddr.ss_family)
+      ((struct sockaddr_in6 *)&addrs[i].saddr)->sin6_port = htons(port);
+  }
+}
+
+static void resolver_worker(void *arg) {
+  nioresolver_t *resolver = (nioresolver_t *)arg;
+  nioresolveentry_t *entry;
+
+  niomutex_lock(&resolver->lock);
+
+  while (!resolver->stop) {
+    entry = resolver->jobs;
+
+    if (!entry) {
+      niocond_wait(&resolver->cond, &resolver->lock);
+      continue;
+    }
+
+    resolver->jobs = entry->jobnext;
+    if (!resolver->jobs)
+      resolver->jobtail = NULL;
+
+    niomutex_unlock(&resolver->lock);
+
+    /* the entry is owned by this worker until the task is posted */
+    entry->count = nio_resolvehost(entry->addrs, NIO_RESOLVEMAX, entry->af,
+                                   entry->hostname, 0);
+    selector_post(resolver->selector, &entry->task);
+
+    niomutex_lock(&resolver->lock);
+  }
+
+  niomutex_unlock(&resolver->lock);
+}
+
+static void resolver_complete(niotask_t *task, int cancel) {
+  nioresolveentry_t *entry = nio_entry(task, nioresolveentry_t, task);
+  nioresolver_t *resolver = entry->resolver;
+  nioresolvewaiter_t *waiter;
+  nio_dynarray(niosockaddr_t, addrs, NIO_RESOLVEMAX);
+
+  /* entries are owned by the cache, it frees them on destroy */
+  if (cancel)
+    return;
+
+  entry->pending = 0;
+  entry->expires =
+      nio_microtime() / 1000 +
+      (entry->count > 0 ? resolver->positivettl : resolver->negativettl);
+
+  while (entry->waiters) {
+    waiter = entry->waiters;
+    entry->waiters = waiter->next;
+
+    memcpy(addrs, entry->addrs, entry->count * sizeof(niosockaddr_t));
+    resolver_setport(addrs, entry->count, waiter->port);
+
+    waiter->callback(waiter->ud, addrs, entry->count);
+    nio_free(waiter);
+  }
+}
+
+static void resolver_deliver(niotask_t *task, int cancel) {
+  nioresolvehit_t *hit = nio_entry(task, nioresolvehit_t, task);
+
+  if (cancel)
+    hit->callback(hit->ud, NULL, 0);
+  else
+    hit->callback(hit->ud, hit->addrs, hit->count);
+
+  nio_free(hit);
+}
+
+static nioresolver_t *resolver_create(nioselector_t *selector) {
+  nioresolver_t *resolver;
+  int i;
+
+  resolver = (nioresolver_t *)nio_calloc(1, sizeof(nioresolver_t));
+  if (!resolver)
+    return NULL;
+
+  resolver->selector = selector;
+  resolver->positivettl = RESOLVER_POSITIVETTL;
+  resolver->negativettl = RESOLVER_NEGATIVETTL;
+
+  niomutex_init(&resolver->lock);
+  niocond_init(&resolver->cond);
+
+  for (i = 0; i < RESOLVER_WORKERS; ++i) {
+    if (0 != niothread_create(&resolver->workers[i], resolver_worker,
+                              resolver))
+      break;
+    resolver->nworkers += 1;
+  }
+
+  if (0 == resolver->nworkers) {
+    niocond_destroy(&resolver->cond);
+    niomutex_destroy(&resolver->lock);
+    nio_free(resolver);
+    return NULL;
+  }
+
+  return resolver;
+}
+
+static void resolver_freeentry(nioresolveentry_t *entry) {
+  nioresolvewaiter_t *waiter;
+
+  /* only pending entries have waiters, the selector is going away */
+  while (entry->waiters) {
+    waiter = entry->waiters;
+    entry->waiters = waiter->next;
+
+    waiter->callback(waiter->ud, NULL, 0);
+    nio_free(waiter);
+  }
+
+  nio_free(entry->hostname);
+  nio_free(entry);
+}
+
+void nioresolver_destroy(nioresolver_t *resolver) {
+  nioresolveentry_t *entry;
+  int i;
+
+  niomutex_lock(&resolver->lock);
+  resolver->stop = 1;
+  niocond_broadcast(&resolver->cond);
+  niomutex_unlock(&resolver->lock);
+
+  /* waits for lookups in flight, getaddrinfo can not be interrupted */
+  for (i = 0; i < resolver->nworkers; ++i)
+    niothread_join(resolver->workers[i]);
+
+  /* completions are dropped, their waiters are failed with the cache */
+  selector_runtasks(resolver->selector, 1);
+
+  for (i = 0; i < RESOLVER_BUCKETS; ++i) {
+    while (resolver->buckets[i]) {
+      entry = resolver->buckets[i];
+      resolver->buckets[i] = entry->next;
+      resolver_freeentry(entry);
+    }
+  }
+
+  niocond_destroy(&resolver->cond);
+  niomutex_destroy(&resolver->lock);
+  nio_free(resolver);
+}
+
+static nioresolveentry_t *resolver_lookup(nioresolver_t *resolver,
+                                          const char *hostname, int af,
+                                          unsigned int hash,
+                                          unsigned long long now) {
+  nioresolveentry_t **link = &resolver->buckets[hash % RESOLVER_BUCKETS];
+  nioresolveentry_t *entry;
+
+  while ((entry = *link) != NULL) {
+    if (entry->hash == hash && entry->af == af &&
+        0 == strcmp(entry->hostname, hostname))
+      return entry;
+
+    /* evict expired neighbours while walking the chain */
+    if (!entry->pending && entry->expires <= now) {
+      *link = entry->next;
+      resolver_freeentry(entry);
+      continue;
+    }
+    link = &entry->next;
+  }
+
+  return NULL;
+}
+
+static nioresolveentry_t *resolver_newentry(nioresolver_t *resolver,
+                                            const char *hostname, int af,
+                                            unsigned int hash) {
+  nioresolveentry_t *entry;
+  size_t len = strlen(hostname);
+
+  entry = (nioresolveentry_t *)nio_calloc(1, sizeof(nioresolveentry_t));
+  if (!entry)
+    return NULL;
+
+  entry->hostname = (char *)nio_malloc(len + 1);
+  if (!entry->hostname) {
+    nio_free(entry);
+    return NULL;
+  }
+
+  memcpy(entry->hostname, hostname, len + 1);
+
+  entry->task.run = resolver_complete;
+  entry->resolver = resolver;
+  entry->af = af;
+  entry->hash = hash;
+
+  entry->next = resolver->buckets[hash % RESOLVER_BUCKETS];
+  resolver->buckets[hash % RESOLVER_BUCKETS] = entry;
+
+  return entry;
+}
+
+static int resolver_posthit(nioselector_t *selector, const niosockaddr_t *addrs,
+                            int count, unsigned short port,
+                            nio_resolvecallback callback, void *ud) {
+  nioresolvehit_t *hit = (nioresolvehit_t *)nio_malloc(sizeof(nioresolvehit_t));
+  if (!hit)
+    return -1;
+
+  hit->task.run = resolver_deliver;
+  hit->callback = callback;
+  hit->ud = ud;
+  hit->count = count;
+
+  memcpy(hit->addrs, addrs, count * sizeof(niosockaddr_t));
+  resolver_setport(hit->addrs, count, port);
+
+  return selector_post(selector, &hit->task);
+}
+
+int selector_resolve(nioselector_t *selector, const char *hostname,
+                     unsigned short port, int af, nio_resolvecallback callback,
+                     void *ud) {
+  nioresolver_t *resolver;
+  nioresolveentry_t *entry;
+  nioresolvewaiter_t *waiter, **link;
+  unsigned long long now;
+  unsigned int hash;
+
+  if (!callback || selector_closed(selector))
+    return -1;
+
+  if (AF_INET != af && AF_INET6 != af)
+    return -1;
+
+  /* passive addresses never block */
+  if (!hostname) {
+    niosockaddr_t any;
+    int count = nio_resolvehost(&any, 1, af, NULL, port);
+    return resolver_posthit(selector, &any, count, port, callback, ud);
+  }
+
+  if (!selector->resolver) {
+    selector->resolver = resolver_create(selector);
+    if (!selector->resolver)
+      return -1;
+  }
+
+  resolver = selector->resolver;
+  now = nio_microtime() / 1000;
+  hash = resolver_hash(hostname, af);
+
+  entry = resolver_lookup(resolver, hostname, af, hash, now);
+
+  if (entry && !entry->pending && entry->expires > now)
+    return resolver_posthit(selector, entry->addrs, entry->count, port,
+                            callback, ud);
+
+  waiter = (nioresolvewaiter_t *)nio_malloc(sizeof(nioresolvewaiter_t));
+  if (!waiter)
+    return -1;
+
+  if (!entry) {
+    entry = resolver_newentry(resolver, hostname, af, hash);
+
+    if (!entry) {
+      nio_free(waiter);
+      return -1;
+    }
+  }
+
+  waiter->callback = callback;
+  waiter->ud = ud;
+  waiter->port = port;
+  waiter->next = NULL;
+
+  link = &entry->waiters;
+  while (*link)
+    link = &(*link)->next;
+  *link = waiter;
+
+  /* concurrent lookups of the same name share one query */
+  if (entry->pending)
+    return 0;
+
+  entry->pending = 1;
+  entry->jobnext = NULL;
+
+  niomutex_lock(&resolver->lock);
+
+  if (resolver->jobtail)
+    resolver->jobtail->jobnext = entry;
+  else
+    resolver->jobs = entry;
+
+  resolver->jobtail = entry;
+
+  niocond_signal(&resolver->cond);
+  niomutex_unlock(&resolver->lock);
+
+  return 0;
+}
+
+int selector_resolvettl(nioselector_t *selector, unsigned int positive,
+                        unsigned int negative) {
+  if (!selector->resolver) {
+    selector->resolver = resolver_create(selector);
+    if (!selector->resolver)
+      return -1;
+  }
+
+  selector->resolver->positivettl = positive;
+  selector->resolver->negativettl = negative;
+
+  return 0;
+}
@@ -10,7 +10,11 @@
  */
 
 #include "nio4c_internal.h"
-#include <assert.h>
+#include "nio4c_probes.h"
+#include <string.h>
+
+/* the selector whose selector_select is running on this thread */
+static nio_threadlocal nioselector_t *selector_dispatching = NULL;
 
 nioselector_t *nio_selector(void) {
   nioselector_t *selector;
@@ -28,8 +32,29 @@ nioselector_t *nio_selector(void) {
   selector->selector = nio_pollcreate();
   selector->wakeup = sock_pipe[0];
   selector->waker = sock_pipe[1];
+  selector->corked = NULL;
+  selector->tasks = NULL;
+  selector->tasktail = NULL;
+  selector->timers = NULL;
+  selector->ntimers = 0;
+  selector->timercap = 0;
+  selector->resolver = NULL;
+  selector->connects = NULL;
+  selector->busypoll = 0;
+  selector->waking = 0;
+  selector->buried = NULL;
   selector->closed = 0;
+#ifndef NIO_NOSTATS
+  memset(&selector->stats, 0, sizeof(selector->stats));
+  memset(&selector->latency, 0, sizeof(selector->latency));
+  selector->woken = 0;
+  selector->returned = 0;
+  selector->stallthreshold = 0;
+  selector->stall = NULL;
+  selector->stallud = NULL;
+#endif
   niohtable_create(&selector->selectables);
+  niomutex_init(&selector->tasklock);
 
   niopoll_register(selector->selector, nio_sockfd(&selector->wakeup), NULL);
   niopoll_register(selector->selector, nio_sockfd(&selector->waker), NULL);
@@ -42,6 +67,30 @@ nioselector_t *nio_selector(void) {
 }
 
 void selector_destroy(nioselector_t *selector) {
+  niomonitor_t *monitor;
+  niohtableiter_t iter;
+
+  /* callbacks failed below can not start anything new on us */
+  selector->closed = 1;
+
+  /* channels keep their queues but lose the monitor along with us */
+  niohtable_iter(&selector->selectables, &iter);
+  while (0 == niohtable_next(&iter, NULL, &monitor))
+    if (monitor->channel)
+      channel_detach(monitor->channel);
+
+  channel_dropcorked(selector);
+  connect_cancelall(selector);
+  signal_unwatchall(selector);
+
+  if (selector->resolver)
+    nioresolver_destroy(selector->resolver);
+
+  selector_runtasks(selector, 1);
+  niomutex_destroy(&selector->tasklock);
+
+  if (selector->timers)
+    nio_free(selector->timers);
   niopoll_deregister(selector->selector, nio_sockfd(&selector->wakeup));
   niopoll_deregister(selector->selector, nio_sockfd(&selector->waker));
   niopoll_destroy(selector->selector);
@@ -75,9 +124,14 @@ niomonitor_t *selector_register(nioselector_t *selector, niosocket_t *io,
     return NULL;
   }
 
+  NIO_PROBE3(register, selector, nio_sockfd(io), interest);
+
   monitor_resetinterests(monitor);
   niohtable_set(&selector->selectables, io, monitor, NULL);
 
+  if (selector->busypoll > 0)
+    nio_sockbusypoll(io, selector->busypoll);
+
   return monitor;
 }
 
@@ -86,6 +140,7 @@ niomonitor_t *selector_deregister(nioselector_t *selector, niosocket_t *io) {
 
   niohtable_erase(&selector->selectables, io, &monitor);
   if (monitor && !monitor_closed(monitor)) {
+    NIO_PROBE2(deregister, selector, nio_sockfd(io));
     niopoll_deregister(selector->selector, nio_sockfd(io));
     monitor_close(monitor, 0);
   }
@@ -93,50 +148,268 @@ niomonitor_t *selector_deregister(nioselector_t *selector, niosocket_t *io) {
   return monitor;
 }
 
+#ifndef NIO_NOSTATS
+static int selector_bucket(int count) {
+  int bucket = 0;
+
+  while (count > 0 && bucket < NIO_STATSBUCKETS - 1) {
+    count >>= 1;
+    bucket += 1;
+  }
+  return bucket;
+}
+#endif
+
+static int selector_busywait(nioselector_t *selector, nioevent_t *pevt,
+                             int count, int timeout) {
+  unsigned long long start = nio_microtime(), now;
+  unsigned long long spin = selector->busypoll;
+  int ready;
+
+  if (timeout > 0 && spin > (unsigned long long)timeout * 1000)
+    spin = (unsigned long long)timeout * 1000;
+
+  /* trade CPU for wakeup latency, the thread never goes to sleep */
+  do {
+    ready = niopoll_wait(selector->selector, pevt, count, 0);
+    if (0 != ready)
+      return ready;
+    now = nio_microtime();
+  } while (now - start < spin);
+
+  if (timeout > 0) {
+    timeout -= (int)((now - start) / 1000);
+    if (timeout <= 0)
+      return 0;
+  }
+
+  return niopoll_wait(selector->selector, pevt, count, timeout);
+}
+
 int selector_select(nioselector_t *selector, niomonitor_t **monitors, int count,
                     unsigned int millisec) {
-  int i, ready, buffer, offset = 0;
+  int i, ready, buffer, offset = 0, handled = 0, reported = 0;
+  int timeout = (int)millisec;
+  nioselector_t *outer;
+#ifndef NIO_NOSTATS
+  unsigned long long now;
+#endif
   niomonitor_t *monitor;
   niohtableiter_t iter;
   nio_dynarray(nioevent_t, pevt, count);
+  nio_dynarray(niomonitor_t *, handlers, count);
+
+#ifndef NIO_NOSTATS
+  if (selector->returned) {
+    now = nio_microtime() - selector->returned;
+    niolatency_record(&selector->latency, now);
+
+    if (selector->stall && now >= selector->stallthreshold)
+      selector->stall(selector->stallud, now);
+  }
+#endif
+
+  /* push out what the caller corked while handling the last batch */
+  channel_flushcorked(selector);
 
   niohtable_iter(&selector->selectables, &iter);
   while (0 == niohtable_next(&iter, NULL, &monitor))
     monitor->readiness = NIO_NIL;
 
-  ready = niopoll_wait(selector->selector, pevt, count, millisec);
+  /* do not block while completions are waiting to be delivered */
+  niomutex_lock(&selector->tasklock);
+  if (selector->tasks)
+    timeout = 0;
+  niomutex_unlock(&selector->tasklock);
+
+  timeout = selector_nexttimeout(selector, timeout);
+  NIO_PROBE2(select_entry, selector, timeout);
+
+#ifndef NIO_NOSTATS
+  now = nio_microtime();
+  if (selector->woken)
+    selector->stats.handling += now - selector->woken;
+#endif
+
+  if (selector->busypoll > 0 && 0 != timeout)
+    ready = selector_busywait(selector, pevt, count, timeout);
+  else
+    ready = niopoll_wait(selector->selector, pevt, count, timeout);
+
+#ifndef NIO_NOSTATS
+  selector->woken = nio_microtime();
+  selector->stats.blocked += selector->woken - now;
+  selector->stats.waits += 1;
+
+  if (ready > 0) {
+    selector->stats.events += ready;
+    selector->stats.eventsperwait[selector_bucket(ready)] += 1;
+  } else if (0 == ready)
+    selector->stats.eventsperwait[0] += 1;
+#endif
+
+  /* handlers, timers and tasks below may destroy monitors still listed in
+   * handlers[] or monitors[], those stay allocated until the end */
+  outer = selector_dispatching;
+  selector_dispatching = selector;
 
   for (i = 0; i < ready; ++i) {
     monitor = (niomonitor_t *)pevt[i].userdata;
 
-    if (pevt[i].error) {
-      assert(monitor);
-      monitor->readiness |= NIO_IOERROR;
-    }
-
-    if (pevt[i].readable) {
-      if (pevt[i].fd == nio_sockfd(&selector->wakeup))
+    /* only the wakeup pipe is registered without a monitor, and epoll
+     * shares event fd with userdata so it can't be matched by fd */
+    if (!monitor) {
+      if (pevt[i].readable) {
         nio_recv(&selector->wakeup, &buffer, sizeof(buffer));
-      else
-        monitor->readiness |= NIO_READ;
+        /* after the drain, a wakeup racing with it finds us awake anyway */
+        nio_atomicswap(&selector->waking, 0);
+      }
+      continue;
     }
 
+    NIO_PROBE5(event, selector, nio_sockfd(monitor->io), pevt[i].readable,
+               pevt[i].writeable, pevt[i].error);
+
+    if (pevt[i].error)
+      monitor->readiness |= NIO_IOERROR;
+
+    if (pevt[i].readable)
+      monitor->readiness |= NIO_READ;
+
     if (pevt[i].writeable)
       monitor->readiness |= NIO_WRITE;
 
-    if (monitor)
-      monitors[offset++] = monitor;
+    /* internal monitors are dispatched once the batch is collected */
+    if (monitor->handler) {
+      if (NIO_DISPATCH != (monitor->readiness & NIO_DISPATCH)) {
+        monitor->readiness |= NIO_DISPATCH;
+        handlers[handled++] = monitor;
+      }
+      continue;
+    }
+
+    monitors[offset++] = monitor;
   }
 
+  for (i = 0; i < handled; ++i)
+    if (!monitor_closed(handlers[i]) && handlers[i]->handler(handlers[i]))
+      monitors[offset++] = handlers[i];
+
+  selector_runtimers(selector);
+  selector_runtasks(selector, 0);
+
+  /* and what handlers, timers and tasks corked in this one */
+  channel_flushcorked(selector);
+
+  selector_dispatching = outer;
+
+  /* closed during the dispatch, nothing left to report */
+  for (i = 0; i < offset; ++i)
+    if (!monitor_closed(monitors[i]))
+      monitors[reported++] = monitors[i];
+  offset = reported;
+
+  while (outer != selector && selector->buried) {
+    monitor = selector->buried;
+    selector->buried = monitor->buried;
+    nio_free(monitor);
+  }
+
+#ifndef NIO_NOSTATS
+  selector->returned = nio_microtime();
+#endif
+
+  NIO_PROBE3(select_return, selector, ready, offset);
+
   return offset;
 }
 
+int selector_bury(niomonitor_t *monitor) {
+  nioselector_t *selector = monitor->selector;
+
+  if (selector != selector_dispatching)
+    return 0;
+
+  monitor->buried = selector->buried;
+  selector->buried = monitor;
+  return 1;
+}
+
+int selector_setbusypoll(nioselector_t *selector, unsigned int usec) {
+  niomonitor_t *monitor;
+  niohtableiter_t iter;
+
+  selector->busypoll = usec;
+
+  niohtable_iter(&selector->selectables, &iter);
+  while (0 == niohtable_next(&iter, NULL, &monitor))
+    nio_sockbusypoll(monitor->io, usec);
+
+  return 0;
+}
+
 int selector_wakeup(nioselector_t *selector) {
   char sig = '\0';
+
+  /* one octet in flight is enough, the rest only fill the pipe */
+  if (nio_atomicswap(&selector->waking, 1)) {
+#ifndef NIO_NOSTATS
+    nio_atomicinc(&selector->stats.coalesced);
+#endif
+    return 0;
+  }
+
+#ifndef NIO_NOSTATS
+  nio_atomicinc(&selector->stats.wakeups);
+#endif
   nio_send(&selector->waker, &sig, sizeof(sig));
   return 0;
 }
 
+int selector_post(nioselector_t *selector, niotask_t *task) {
+  int wakeup;
+
+  task->next = NULL;
+
+  niomutex_lock(&selector->tasklock);
+
+  wakeup = !selector->tasks;
+
+  if (selector->tasktail)
+    selector->tasktail->next = task;
+  else
+    selector->tasks = task;
+
+  selector->tasktail = task;
+
+  niomutex_unlock(&selector->tasklock);
+
+  if (wakeup)
+    selector_wakeup(selector);
+
+  return 0;
+}
+
+int selector_runtasks(nioselector_t *selector, int cancel) {
+  niotask_t *task, *next;
+  int count = 0;
+
+  niomutex_lock(&selector->tasklock);
+  task = selector->tasks;
+  selector->tasks = NULL;
+  selector->tasktail = NULL;
+  niomutex_unlock(&selector->tasklock);
+
+  while (task) {
+    next = task->next;
+    task->run(task, cancel);
+    task = next;
+    count += 1;
+  }
+
+  return count;
+}
+
 int selector_registered(nioselector_t *selector, niosocket_t *io) {
   return 0 == niohtable_get(&selector->selectables, io, NULL);
 }
@@ -157,3 +430,56 @@ int selector_closed(nioselector_t *selector) { return selector->closed; }
 int selector_empty(nioselector_t *selector) {
   return selector->selectables.used == 0;
 }
+
+int selector_stats(nioselector_t *selector, nioselectorstats_t *stats) {
+#ifndef NIO_NOSTATS
+  memcpy(stats, &selector->stats, sizeof(nioselectorstats_t));
+  stats->registered = selector->selectables.used;
+
+  /* bumped from other threads, a plain 64-bit read may tear on 32-bit */
+  stats->wakeups = nio_atomicload(&selector->stats.wakeups);
+  stats->coalesced = nio_atomicload(&selector->stats.coalesced);
+  return 0;
+#else
+  memset(stats, 0, sizeof(nioselectorstats_t));
+  stats->registered = selector->selectables.used;
+  return -1;
+#endif
+}
+
+int selector_latency(nioselector_t *selector, nioselectorlatency_t *latency) {
+#ifndef NIO_NOSTATS
+  memcpy(latency, &selector->latency, sizeof(nioselectorlatency_t));
+  return 0;
+#else
+  (void)selector;
+  memset(latency, 0, sizeof(nioselectorlatency_t));
+  return -1;
+#endif
+}
+
+int selector_resetlatency(nioselector_t *selector) {
+#ifndef NIO_NOSTATS
+  memset(&selector->latency, 0, sizeof(nioselectorlatency_t));
+  return 0;
+#else
+  (void)selector;
+  return -1;
+#endif
+}
+
+int selector_setstall(nioselector_t *selector, unsigned long long threshold,
+                      nio_stallcallback callback, void *ud) {
+#ifndef NIO_NOSTATS
+  selector->stallthreshold = threshold;
+  selector->stall = callback;
+  selector->stallud = ud;
+  return 0;
+#else
+  (void)selector;
+  (void)threshold;
+  (void)callback;
+  (void)ud;
+  return -1;
+#endif
+}
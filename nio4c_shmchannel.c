@@ -0,0 +1,358 @@
+/*
+ *  nio4c_shmchannel.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+#include <string.h>
+
+#ifndef _WIN32
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#define SHM_EVENTFD 1
+#endif
+
+#define SHM_MAGIC 0x6E696F72U
+#define SHM_CACHELINE 64
+#define SHM_HEADERSIZE (SHM_CACHELINE * 3)
+#define SHM_MINCAPACITY 4096U
+#define SHM_RECORDLEN sizeof(uint32_t)
+
+typedef struct nioshmheader_s {
+  uint32_t magic;
+  uint32_t capacity;
+  char pad0[SHM_CACHELINE - sizeof(uint32_t) * 2];
+  uint32_t head; /* consumer owned */
+  uint32_t waiting;
+  char pad1[SHM_CACHELINE - sizeof(uint32_t) * 2];
+  uint32_t tail; /* producer owned */
+  char pad2[SHM_CACHELINE - sizeof(uint32_t)];
+} nioshmheader_t;
+
+struct nioshmchannel_s {
+  nioshmheader_t *header;
+  unsigned char *ring;
+  uint32_t mask;
+  size_t mapsize;
+  int fds[NIO_SHMFDS];
+  niosocket_t io;
+};
+
+#define shm_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define shm_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static int shm_memfd(size_t size) {
+  int fd;
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+  fd = (int)syscall(SYS_memfd_create, "nio4c", 1U /* MFD_CLOEXEC */);
+#else
+  char name[64];
+
+  /* anonymous once unlinked, only the descriptors keep it alive */
+  snprintf(name, sizeof(name), "/nio4c.%d.%p", (int)getpid(), (void *)&name);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0) {
+    shm_unlink(name);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+#endif
+
+  if (fd < 0)
+    return -1;
+
+  if (0 != ftruncate(fd, (off_t)size)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int shm_doorbell(int fds[2]) {
+#ifdef SHM_EVENTFD
+  fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  fds[1] = fds[0];
+  return fds[0] < 0 ? -1 : 0;
+#else
+  niosocket_t socks[2];
+
+  if (0 != nio_pipe(socks))
+    return -1;
+
+  nio_socketnonblock(&socks[0], 1);
+  nio_socketnonblock(&socks[1], 1);
+  fcntl(socks[0].sockfd, F_SETFD, FD_CLOEXEC);
+  fcntl(socks[1].sockfd, F_SETFD, FD_CLOEXEC);
+
+  fds[0] = socks[0].sockfd;
+  fds[1] = socks[1].sockfd;
+  return 0;
+#endif
+}
+
+static void shm_ring(nioshmchannel_t *channel) {
+  uint64_t one = 1;
+
+  /* full or already signalled both mean the consumer will wake up */
+  if (write(channel->fds[2], &one, sizeof(one)) < 0) {
+  }
+}
+
+static void shm_drain(nioshmchannel_t *channel) {
+  uint64_t counter[8];
+
+  while (read(channel->fds[1], counter, sizeof(counter)) > 0)
+    ;
+}
+
+static void shm_copyin(nioshmchannel_t *channel, uint32_t pos,
+                       const void *data, uint32_t len) {
+  uint32_t offset = pos & channel->mask;
+  uint32_t first = channel->mask + 1 - offset;
+
+  if (first > len)
+    first = len;
+
+  memcpy(channel->ring + offset, data, first);
+  memcpy(channel->ring, (const unsigned char *)data + first, len - first);
+}
+
+static void shm_copyout(nioshmchannel_t *channel, uint32_t pos, void *data,
+                        uint32_t len) {
+  uint32_t offset = pos & channel->mask;
+  uint32_t first = channel->mask + 1 - offset;
+
+  if (first > len)
+    first = len;
+
+  memcpy(data, channel->ring + offset, first);
+  memcpy((unsigned char *)data + first, channel->ring, len - first);
+}
+
+static nioshmchannel_t *shm_map(const int fds[NIO_SHMFDS], int create,
+                                uint32_t capacity) {
+  nioshmchannel_t *channel;
+  struct stat st;
+  void *addr;
+
+  channel = (nioshmchannel_t *)nio_calloc(1, sizeof(nioshmchannel_t));
+  if (!channel)
+    return NULL;
+
+  if (!create) {
+    if (0 != fstat(fds[0], &st) || st.st_size <= SHM_HEADERSIZE)
+      goto error;
+    channel->mapsize = (size_t)st.st_size;
+  } else
+    channel->mapsize = SHM_HEADERSIZE + (size_t)capacity;
+
+  addr = mmap(NULL, channel->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+              fds[0], 0);
+  if (MAP_FAILED == addr)
+    goto error;
+
+  channel->header = (nioshmheader_t *)addr;
+  channel->ring = (unsigned char *)addr + SHM_HEADERSIZE;
+
+  if (create) {
+    channel->header->capacity = capacity;
+    channel->header->waiting = 1;
+    shm_store(&channel->header->magic, SHM_MAGIC);
+  } else if (SHM_MAGIC != shm_load(&channel->header->magic) ||
+             0 != (capacity = channel->header->capacity) % SHM_MINCAPACITY ||
+             0 != (capacity & (capacity - 1)) ||
+             channel->mapsize != SHM_HEADERSIZE + (size_t)capacity) {
+    munmap(addr, channel->mapsize);
+    goto error;
+  }
+
+  memcpy(channel->fds, fds, sizeof(channel->fds));
+  channel->mask = channel->header->capacity - 1;
+  channel->io.sockfd = fds[1];
+
+  return channel;
+
+error:
+  nio_free(channel);
+  return NULL;
+}
+
+nioshmchannel_t *nio_shmchannel(unsigned int capacity) {
+  nioshmchannel_t *channel;
+  uint32_t size = SHM_MINCAPACITY;
+  int fds[NIO_SHMFDS];
+
+  /* power of two, positions wrap freely and index with a mask */
+  while (size < capacity && size < 0x40000000U)
+    size <<= 1;
+
+  fds[0] = shm_memfd(SHM_HEADERSIZE + (size_t)size);
+  if (fds[0] < 0)
+    return NULL;
+
+  if (0 != shm_doorbell(&fds[1])) {
+    close(fds[0]);
+    return NULL;
+  }
+
+  channel = shm_map(fds, 1, size);
+  if (!channel) {
+    close(fds[0]);
+    close(fds[1]);
+    if (fds[2] != fds[1])
+      close(fds[2]);
+  }
+
+  return channel;
+}
+
+nioshmchannel_t *nio_shmchannelattach(const int fds[NIO_SHMFDS]) {
+  return shm_map(fds, 0, 0);
+}
+
+void shmchannel_destroy(nioshmchannel_t *channel) {
+  munmap(channel->header, channel->mapsize);
+
+  close(channel->fds[0]);
+  close(channel->fds[1]);
+  if (channel->fds[2] != channel->fds[1])
+    close(channel->fds[2]);
+
+  nio_free(channel);
+}
+
+int shmchannel_fds(nioshmchannel_t *channel, int fds[NIO_SHMFDS]) {
+  memcpy(fds, channel->fds, sizeof(channel->fds));
+  return 0;
+}
+
+niosocket_t *shmchannel_io(nioshmchannel_t *channel) { return &channel->io; }
+
+int shmchannel_write(nioshmchannel_t *channel, const void *data, int len) {
+  nioshmheader_t *header = channel->header;
+  uint32_t head, tail, length = (uint32_t)len;
+
+  if (len <= 0 || length + SHM_RECORDLEN > header->capacity)
+    return -1;
+
+  head = shm_load(&header->head);
+  tail = header->tail;
+
+  if (header->capacity - (tail - head) < length + SHM_RECORDLEN)
+    return 0;
+
+  shm_copyin(channel, tail, &length, SHM_RECORDLEN);
+  shm_copyin(channel, tail + SHM_RECORDLEN, data, length);
+  shm_store(&header->tail, tail + SHM_RECORDLEN + length);
+
+  /* pairs with the fence in shmchannel_read, one side always sees the other */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&header->waiting, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&header->waiting, 0, __ATOMIC_ACQ_REL))
+    shm_ring(channel);
+
+  return len;
+}
+
+int shmchannel_read(nioshmchannel_t *channel, void *buf, int len) {
+  nioshmheader_t *header = channel->header;
+  uint32_t head, tail, length;
+
+  head = header->head;
+  tail = shm_load(&header->tail);
+
+  if (head == tail) {
+    shm_drain(channel);
+
+    /* the producer skips the doorbell until we are about to sleep */
+    __atomic_store_n(&header->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    tail = shm_load(&header->tail);
+    if (head == tail)
+      return 0;
+
+    __atomic_store_n(&header->waiting, 0, __ATOMIC_RELAXED);
+  }
+
+  shm_copyout(channel, head, &length, SHM_RECORDLEN);
+
+  if (tail - head < length + SHM_RECORDLEN)
+    return -1;
+
+  if (len < 0 || (uint32_t)len < length)
+    return -1;
+
+  shm_copyout(channel, head + SHM_RECORDLEN, buf, length);
+  shm_store(&header->head, head + SHM_RECORDLEN + length);
+
+  return (int)length;
+}
+
+int shmchannel_peeksize(nioshmchannel_t *channel) {
+  nioshmheader_t *header = channel->header;
+  uint32_t head = header->head, length;
+
+  if (head == shm_load(&header->tail))
+    return 0;
+
+  shm_copyout(channel, head, &length, SHM_RECORDLEN);
+  return (int)length;
+}
+#else
+nioshmchannel_t *nio_shmchannel(unsigned int capacity) {
+  (void)capacity;
+  return NULL;
+}
+
+nioshmchannel_t *nio_shmchannelattach(const int fds[NIO_SHMFDS]) {
+  (void)fds;
+  return NULL;
+}
+
+void shmchannel_destroy(nioshmchannel_t *channel) { (void)channel; }
+
+int shmchannel_fds(nioshmchannel_t *channel, int fds[NIO_SHMFDS]) {
+  (void)channel;
+  (void)fds;
+  return -1;
+}
+
+niosocket_t *shmchannel_io(nioshmchannel_t *channel) {
+  (void)channel;
+  return NULL;
+}
+
+int shmchannel_write(nioshmchannel_t *channel, const void *data, int len) {
+  (void)channel;
+  (void)data;
+  (void)len;
+  return -1;
+}
+
+int shmchannel_read(nioshmchannel_t *channel, void *buf, int len) {
+  (void)channel;
+  (void)buf;
+  (void)len;
+  return -1;
+}
+
+int shmchannel_peeksize(nioshmchannel_t *channel) {
+  (void)channel;
+  return -1;
+}
+#endif
@@ -0,0 +1,240 @@
+/*
+ *  nio4c_signal.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/signalfd.h>
+#define SIGNAL_FD 1
+#endif
+
+#ifndef NSIG
+#define NSIG 65
+#endif
+
+typedef struct niosignal_s {
+  niosocket_t io;
+  int signo;
+#ifndef SIGNAL_FD
+  struct sigaction saved;
+#else
+  int wasblocked;
+#endif
+} niosignal_t;
+
+/* a signal can only be routed to one watcher per process */
+static niosignal_t *signal_watchers[NSIG];
+static pthread_mutex_t signal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef SIGNAL_FD
+static int signal_open(niosignal_t *sig) {
+  sigset_t mask, old;
+  int fd;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, sig->signo);
+
+  /* blocked, or the default disposition still runs */
+  if (0 != pthread_sigmask(SIG_BLOCK, &mask, &old))
+    return -1;
+
+  sig->wasblocked = sigismember(&old, sig->signo);
+
+  fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    if (!sig->wasblocked)
+      pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    return -1;
+  }
+
+  sig->io.sockfd = fd;
+  return 0;
+}
+
+static void signal_close(niosignal_t *sig) {
+  sigset_t mask;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, sig->signo);
+
+  close(sig->io.sockfd);
+
+  /* the application may have blocked it for its own sigwait */
+  if (!sig->wasblocked)
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+static void signal_drain(niosignal_t *sig) {
+  struct signalfd_siginfo info[8];
+
+  while (read(sig->io.sockfd, info, sizeof(info)) > 0)
+    ;
+}
+#else
+static int signal_writers[NSIG];
+
+static void signal_catch(int signo) {
+  unsigned char octet = (unsigned char)signo;
+  int saved = errno;
+
+  /* async-signal-safe, a full pipe already means pending */
+  if (write(signal_writers[signo], &octet, 1) < 0) {
+  }
+  errno = saved;
+}
+
+static int signal_open(niosignal_t *sig) {
+  niosocket_t socks[2];
+  struct sigaction sa;
+
+  if (0 != nio_pipe(socks))
+    return -1;
+
+  nio_socketnonblock(&socks[0], 1);
+  nio_socketnonblock(&socks[1], 1);
+  fcntl(socks[0].sockfd, F_SETFD, FD_CLOEXEC);
+  fcntl(socks[1].sockfd, F_SETFD, FD_CLOEXEC);
+
+  signal_writers[sig->signo] = socks[1].sockfd;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = signal_catch;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  if (0 != sigaction(sig->signo, &sa, &sig->saved)) {
+    nio_destroysocket(&socks[0]);
+    nio_destroysocket(&socks[1]);
+    return -1;
+  }
+
+  sig->io = socks[0];
+  return 0;
+}
+
+static void signal_close(niosignal_t *sig) {
+  sigaction(sig->signo, &sig->saved, NULL);
+
+  close(signal_writers[sig->signo]);
+  close(sig->io.sockfd);
+}
+
+static void signal_drain(niosignal_t *sig) {
+  unsigned char octets[64];
+
+  while (recv(sig->io.sockfd, (char *)octets, sizeof(octets), 0) > 0)
+    ;
+}
+#endif
+
+static int signal_handler(niomonitor_t *monitor) {
+  niosignal_t *sig = nio_entry(monitor_io(monitor), niosignal_t, io);
+
+  /* coalesced, one readiness however many arrived since the last wait */
+  signal_drain(sig);
+  return 1;
+}
+
+niomonitor_t *selector_watchsignal(nioselector_t *selector, int signo,
+                                   void *ud) {
+  niomonitor_t *monitor;
+  niosignal_t *sig;
+
+  if (signo <= 0 || signo >= NSIG || selector_closed(selector))
+    return NULL;
+
+  sig = (niosignal_t *)nio_calloc(1, sizeof(niosignal_t));
+  if (!sig)
+    return NULL;
+
+  sig->signo = signo;
+
+  /* selectors on other threads may claim the same signal */
+  pthread_mutex_lock(&signal_lock);
+
+  if (signal_watchers[signo] || 0 != signal_open(sig)) {
+    pthread_mutex_unlock(&signal_lock);
+    nio_free(sig);
+    return NULL;
+  }
+
+  monitor = selector_register(selector, &sig->io, NIO_READ, ud);
+  if (!monitor) {
+    signal_close(sig);
+    pthread_mutex_unlock(&signal_lock);
+    nio_free(sig);
+    return NULL;
+  }
+  monitor->handler = signal_handler;
+
+  signal_watchers[signo] = sig;
+  pthread_mutex_unlock(&signal_lock);
+
+  return monitor;
+}
+
+int selector_unwatchsignal(nioselector_t *selector, niomonitor_t *monitor) {
+  niosignal_t *sig = nio_entry(monitor_io(monitor), niosignal_t, io);
+
+  if (monitor->handler != signal_handler)
+    return -1;
+
+  selector_deregister(selector, &sig->io);
+  monitor_destroy(monitor);
+
+  pthread_mutex_lock(&signal_lock);
+  signal_watchers[sig->signo] = NULL;
+  signal_close(sig);
+  pthread_mutex_unlock(&signal_lock);
+
+  nio_free(sig);
+  return 0;
+}
+
+void signal_unwatchall(nioselector_t *selector) {
+  niomonitor_t *monitor, *found;
+  niohtableiter_t iter;
+
+  /* unwatching changes the table, look again from the start each time */
+  do {
+    found = NULL;
+
+    niohtable_iter(&selector->selectables, &iter);
+    while (!found && 0 == niohtable_next(&iter, NULL, &monitor))
+      if (monitor->handler == signal_handler)
+        found = monitor;
+
+    if (found)
+      selector_unwatchsignal(selector, found);
+  } while (found);
+}
+#else
+niomonitor_t *selector_watchsignal(nioselector_t *selector, int signo,
+                                   void *ud) {
+  (void)selector;
+  (void)signo;
+  (void)ud;
+  return NULL;
+}
+
+int selector_unwatchsignal(nioselector_t *selector, niomonitor_t *monitor) {
+  (void)selector;
+  (void)monitor;
+  return -1;
+}
+
+void signal_unwatchall(nioselector_t *selector) { (void)selector; }
+#endif
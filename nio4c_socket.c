@@ -9,7 +9,12 @@
  *  https://github.com/shixiongfei/nio4c
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* accept4 */
+#endif
+
 #include "nio4c_internal.h"
+#include "nio4c_probes.h"
 
 #if defined(__APPLE__)
 #include <CoreFoundation/CoreFoundation.h>
@@ -25,6 +30,21 @@
 #endif
 #endif
 
+#include <limits.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
+
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#include <netinet/tcp_fsm.h>
+#endif
+
 #if defined(__linux__) || defined(__BSD__)
 #include <net/ethernet.h>
 #include <net/if_arp.h>
@@ -290,8 +310,10 @@ int nio_resolvehost(niosockaddr_t *addr_list, int count, int af,
     char port_str[8] = {0};
 
     memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_DGRAM;
+    /* only the wanted family is queried, any one socktype keeps each
+     * address from coming back once per socktype */
+    hints.ai_family = af;
+    hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
 
     sprintf(port_str, "%d", port);
@@ -389,6 +411,34 @@ static const char *nio_inetntop(int af, const void *addr, char *strbuf,
 #endif /* _WIN32 */
 }
 
+#define socket_addrlen(ss) ((socklen_t)nio_sockaddrlen(ss))
+
+int nio_sockaddrlen(const struct sockaddr_storage *ss) {
+  switch (ss->ss_family) {
+  case AF_INET:
+    return sizeof(struct sockaddr_in);
+  case AF_INET6:
+    return sizeof(struct sockaddr_in6);
+#ifndef _WIN32
+  case AF_UNIX: {
+    const struct sockaddr_un *un = (const struct sockaddr_un *)ss;
+    size_t maxlen = sizeof(un->sun_path);
+
+    /* abstract names run to the end of the address, not to a NUL, so they
+     * are kept NUL free and sized the same way as paths */
+    if ('\0' == un->sun_path[0] && '\0' != un->sun_path[1])
+      return (int)(offsetof(struct sockaddr_un, sun_path) + 1 +
+                   strnlen(un->sun_path + 1, maxlen - 1));
+
+    return (int)(offsetof(struct sockaddr_un, sun_path) +
+                 strnlen(un->sun_path, maxlen));
+  }
+#endif
+  default:
+    return 0;
+  }
+}
+
 static int in6_equal(const struct in6_addr *a, const struct in6_addr *b) {
   return 0 == memcmp(a, b, sizeof(*a));
 }
@@ -410,6 +460,13 @@ int nio_sockaddrequal(const niosockaddr_t *a, const niosockaddr_t *b) {
     return (in6_equal(&a6->sin6_addr, &b6->sin6_addr) &&
             a6->sin6_port == b6->sin6_port);
   }
+#ifndef _WIN32
+  case AF_UNIX: {
+    int len = nio_sockaddrlen(&a->saddr);
+    return len == nio_sockaddrlen(&b->saddr) &&
+           0 == memcmp(&a->saddr, &b->saddr, len);
+  }
+#endif
   default:
     return 0;
   }
@@ -538,16 +595,126 @@ int nio_inprogress(void) {
   return SOCKERR_EAGAIN == errcode || SOCKERR_EINPROGRESS == errcode;
 }
 
-static int nio_createsocket(niosocket_t *s, int af, int type, int protocol) {
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+#define SOCKET_ATOMICFLAGS 1
+#endif
+
+#if defined(SOCKET_ATOMICFLAGS) && (defined(__linux__) || defined(__BSD__))
+#define SOCKET_ACCEPT4 1
+#endif
+
+static int socket_setflags(niosocket_t *s, int flags) {
+#ifndef _WIN32
+  if (NIO_SOCKCLOEXEC == (flags & NIO_SOCKCLOEXEC))
+    if (0 != fcntl(s->sockfd, F_SETFD, FD_CLOEXEC))
+      return -1;
+#endif
+  if (NIO_SOCKNONBLOCK == (flags & NIO_SOCKNONBLOCK))
+    return nio_socketnonblock(s, 1);
+
+  return 0;
+}
+
+static int nio_createsocket(niosocket_t *s, int af, int type, int protocol,
+                            int flags) {
   if (!s)
     return -1;
 
 #ifndef _WIN32
+#ifdef SOCKET_ATOMICFLAGS
+  /* flags at creation save the fcntl round trips */
+  if (NIO_SOCKNONBLOCK == (flags & NIO_SOCKNONBLOCK))
+    type |= SOCK_NONBLOCK;
+  if (NIO_SOCKCLOEXEC == (flags & NIO_SOCKCLOEXEC))
+    type |= SOCK_CLOEXEC;
+  flags = 0;
+#endif
   s->sockfd = socket(af, type, protocol);
+#else
+#ifdef WSA_FLAG_NO_HANDLE_INHERIT
+  s->sockfd = (int)WSASocket(af, type, protocol, NULL, 0,
+                             (NIO_SOCKCLOEXEC == (flags & NIO_SOCKCLOEXEC))
+                                 ? WSA_FLAG_NO_HANDLE_INHERIT
+                                 : 0);
 #else
   s->sockfd = (int)WSASocket(af, type, protocol, NULL, 0, 0);
 #endif
-  return (INVALID_SOCKET != s->sockfd) ? 0 : -1;
+#endif
+  if (INVALID_SOCKET == s->sockfd)
+    return -1;
+
+  if (0 != socket_setflags(s, flags)) {
+    nio_destroysocket(s);
+    return -1;
+  }
+  return 0;
+}
+
+int nio_createunix(niosocket_t *s, int type) {
+#ifndef _WIN32
+  if (SOCK_STREAM != type && SOCK_DGRAM != type && SOCK_SEQPACKET != type)
+    return -1;
+  return nio_createsocket(s, AF_UNIX, type, 0, 0);
+#else
+  (void)s;
+  (void)type;
+  return -1;
+#endif
+}
+
+int nio_unixaddr(niosockaddr_t *addr, const char *path) {
+#ifndef _WIN32
+  struct sockaddr_un *un = (struct sockaddr_un *)&addr->saddr;
+  size_t len = strlen(path);
+
+  if (0 == len || len >= sizeof(un->sun_path))
+    return -1;
+
+  memset(addr, 0, sizeof(niosockaddr_t));
+  un->sun_family = AF_UNIX;
+  memcpy(un->sun_path, path, len);
+
+#if defined(__linux__)
+  if ('@' == path[0]) {
+    if (1 == len)
+      return -1;
+    un->sun_path[0] = '\0';
+  }
+#endif
+  return 0;
+#else
+  (void)addr;
+  (void)path;
+  return -1;
+#endif
+}
+
+int nio_unixpath(const niosockaddr_t *addr, char *path, int len) {
+#ifndef _WIN32
+  const struct sockaddr_un *un = (const struct sockaddr_un *)&addr->saddr;
+  int pathlen;
+
+  if (AF_UNIX != addr->saddr.ss_family || len <= 0)
+    return -1;
+
+  pathlen = (int)(socket_addrlen(&addr->saddr) -
+                  offsetof(struct sockaddr_un, sun_path));
+  if (pathlen >= len)
+    pathlen = len - 1;
+
+  memcpy(path, un->sun_path, pathlen);
+  path[pathlen] = '\0';
+
+  if (pathlen > 0 && '\0' == path[0])
+    path[0] = '@';
+
+  return pathlen;
+#else
+  (void)addr;
+  (void)path;
+  (void)len;
+  return -1;
+#endif
 }
 
 int nio_createtcp(niosocket_t *s, int af) {
@@ -559,11 +726,17 @@ int nio_createtcp(niosocket_t *s, int af) {
 }
 
 int nio_createtcp4(niosocket_t *s) {
-  return nio_createsocket(s, AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  return nio_createsocket(s, AF_INET, SOCK_STREAM, IPPROTO_TCP, 0);
 }
 
 int nio_createtcp6(niosocket_t *s) {
-  return nio_createsocket(s, AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+  return nio_createsocket(s, AF_INET6, SOCK_STREAM, IPPROTO_TCP, 0);
+}
+
+int nio_createtcpex(niosocket_t *s, int af, int flags) {
+  if (AF_INET != af && AF_INET6 != af)
+    return -1;
+  return nio_createsocket(s, af, SOCK_STREAM, IPPROTO_TCP, flags);
 }
 
 int nio_createudp(niosocket_t *s, int af) {
@@ -575,11 +748,11 @@ int nio_createudp(niosocket_t *s, int af) {
 }
 
 int nio_createudp4(niosocket_t *s) {
-  return nio_createsocket(s, AF_INET, SOCK_DGRAM, IPPROTO_IP);
+  return nio_createsocket(s, AF_INET, SOCK_DGRAM, IPPROTO_IP, 0);
 }
 
 int nio_createudp6(niosocket_t *s) {
-  return nio_createsocket(s, AF_INET6, SOCK_DGRAM, IPPROTO_IP);
+  return nio_createsocket(s, AF_INET6, SOCK_DGRAM, IPPROTO_IP, 0);
 }
 
 void nio_initsocket(niosocket_t *s) { s->sockfd = INVALID_SOCKET; }
@@ -600,15 +773,9 @@ void nio_destroysocket(niosocket_t *s) {
   s->sockfd = INVALID_SOCKET;
 }
 
-#define sockaddr_len(a)                                                        \
-  ((NULL == (a))                  ? 0                                          \
-   : (AF_INET == (a)->ss_family)  ? sizeof(struct sockaddr_in)                 \
-   : (AF_INET6 == (a)->ss_family) ? sizeof(struct sockaddr_in6)                \
-                                  : 0)
-
 int nio_bind(niosocket_t *s, const niosockaddr_t *addr) {
   return bind(s->sockfd, (struct sockaddr *)(&addr->saddr),
-              sockaddr_len(&addr->saddr));
+              socket_addrlen(&addr->saddr));
 }
 
 int nio_listen(niosocket_t *s, int backlog) {
@@ -617,29 +784,93 @@ int nio_listen(niosocket_t *s, int backlog) {
 
 int nio_connect(niosocket_t *s, const niosockaddr_t *addr) {
 #ifndef _WIN32
-  return connect(s->sockfd, (struct sockaddr *)(&addr->saddr),
-                 sockaddr_len(&addr->saddr));
+  int retval = connect(s->sockfd, (struct sockaddr *)(&addr->saddr),
+                       socket_addrlen(&addr->saddr));
+
+  NIO_PROBE2(connect, s->sockfd, retval);
+  return retval;
 #else
   return WSAConnect(s->sockfd, (struct sockaddr *)(&addr->saddr),
-                    sockaddr_len(&addr->saddr), NULL, NULL, NULL, NULL);
+                    socket_addrlen(&addr->saddr), NULL, NULL, NULL, NULL);
 #endif
 }
 
-int nio_accept(niosocket_t *s, niosocket_t *client, niosockaddr_t *addr) {
+static int socket_accept(niosocket_t *s, niosocket_t *client,
+                         niosockaddr_t *addr, int flags) {
   struct sockaddr_storage c_addr;
   socklen_t ca_len = sizeof(c_addr);
+#if defined(SOCKET_ACCEPT4)
+  int type = 0;
+#endif
 
-#ifndef _WIN32
+  /* unnamed and abstract AF_UNIX peers are sized by the zero tail */
+  memset(&c_addr, 0, sizeof(c_addr));
+
+#if defined(SOCKET_ACCEPT4)
+  if (NIO_SOCKNONBLOCK == (flags & NIO_SOCKNONBLOCK))
+    type |= SOCK_NONBLOCK;
+  if (NIO_SOCKCLOEXEC == (flags & NIO_SOCKCLOEXEC))
+    type |= SOCK_CLOEXEC;
+
+  client->sockfd =
+      accept4(s->sockfd, (struct sockaddr *)&c_addr, &ca_len, type);
+  flags = 0;
+#elif !defined(_WIN32)
   client->sockfd = accept(s->sockfd, (struct sockaddr *)&c_addr, &ca_len);
 #else
   client->sockfd =
       (int)WSAAccept(s->sockfd, (struct sockaddr *)&c_addr, &ca_len, NULL, 0);
 #endif
 
+  NIO_PROBE2(accept, s->sockfd, client->sockfd);
+
+  if (INVALID_SOCKET == client->sockfd)
+    return -1;
+
+  if (0 != socket_setflags(client, flags)) {
+    nio_destroysocket(client);
+    return -1;
+  }
+
   if (addr)
     memcpy(&addr->saddr, &c_addr, sizeof(c_addr));
 
-  return (INVALID_SOCKET != client->sockfd) ? 0 : -1;
+  return 0;
+}
+
+int nio_accept(niosocket_t *s, niosocket_t *client, niosockaddr_t *addr) {
+  return socket_accept(s, client, addr, 0);
+}
+
+int nio_acceptmany(niosocket_t *s, niosocket_t *clients, niosockaddr_t *addrs,
+                   int count, int flags) {
+  int accepted = 0, err;
+
+  while (accepted < count) {
+    if (0 == socket_accept(s, &clients[accepted],
+                           addrs ? &addrs[accepted] : NULL, flags)) {
+      accepted += 1;
+      continue;
+    }
+
+    err = socket_errno();
+
+    /* the peer gave up while queued, keep draining */
+#ifndef _WIN32
+    if (ECONNABORTED == err || EINTR == err)
+      continue;
+#else
+    if (WSAECONNRESET == err || WSAEINTR == err)
+      continue;
+#endif
+
+    if (SOCKERR_EAGAIN == err)
+      return accepted;
+
+    return accepted > 0 ? accepted : -1;
+  }
+
+  return accepted;
 }
 
 int nio_shutdown(niosocket_t *s, int how) { return shutdown(s->sockfd, how); }
@@ -647,6 +878,7 @@ int nio_shutdown(niosocket_t *s, int how) { return shutdown(s->sockfd, how); }
 int nio_peeraddr(niosocket_t *s, niosockaddr_t *addr) {
   if (addr) {
     socklen_t size = sizeof(struct sockaddr_storage);
+    memset(&addr->saddr, 0, size);
     return getpeername(s->sockfd, (struct sockaddr *)(&addr->saddr), &size);
   }
   return -1;
@@ -663,6 +895,7 @@ int nio_peeripstr(niosocket_t *s, nioipstr_t *addr) {
 int nio_sockaddr(niosocket_t *s, niosockaddr_t *addr) {
   if (addr) {
     socklen_t size = sizeof(struct sockaddr_storage);
+    memset(&addr->saddr, 0, size);
     return getsockname(s->sockfd, (struct sockaddr *)(&addr->saddr), &size);
   }
   return -1;
@@ -676,6 +909,15 @@ int nio_sockipstr(niosocket_t *s, nioipstr_t *addr) {
   return nio_ipstr(addr, &taddr);
 }
 
+int nio_socketerror(niosocket_t *s) {
+  int error = 0;
+  socklen_t len = sizeof(error);
+
+  if (getsockopt(s->sockfd, SOL_SOCKET, SO_ERROR, (char *)&error, &len) < 0)
+    return socket_errno();
+  return error;
+}
+
 int nio_socketnonblock(niosocket_t *s, int on) {
 #ifdef O_NONBLOCK
   int flags = fcntl(s->sockfd, F_GETFL, 0);
@@ -727,42 +969,307 @@ int nio_tcpkeepvalues(niosocket_t *s, int idle, int interval, int count) {
   return 0;
 }
 
+int nio_sockbusypoll(niosocket_t *s, unsigned int usec) {
+#if defined(SO_BUSY_POLL)
+  int value = (int)usec;
+
+  /* raising it past net.core.busy_poll needs CAP_NET_ADMIN */
+  if (0 != setsockopt(s->sockfd, SOL_SOCKET, SO_BUSY_POLL, (char *)&value,
+                      sizeof(value)))
+    return -1;
+
+#if defined(SO_PREFER_BUSY_POLL)
+  value = usec > 0;
+  setsockopt(s->sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (char *)&value,
+             sizeof(value));
+#endif
+  return 0;
+#else
+  (void)s;
+  (void)usec;
+  return -1;
+#endif
+}
+
+int nio_reuseport(niosocket_t *s, int on) {
+#if defined(SO_REUSEPORT)
+  return 0 == setsockopt(s->sockfd, SOL_SOCKET, SO_REUSEPORT, (char *)&on,
+                         sizeof(on))
+             ? 0
+             : -1;
+#else
+  (void)s;
+  (void)on;
+  return -1;
+#endif
+}
+
+int nio_reuseportgroup(niosocket_t *listeners, int count, int policy) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+  struct sock_filter code[3];
+  struct sock_fprog prog;
+  int i;
+
+  /* a mask picks the listener, the group must be a power of two */
+  if (count <= 0 || 0 != (count & (count - 1)))
+    return -1;
+
+  if (NIO_REUSEPORT_CPU == policy)
+    code[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                           SKF_AD_OFF + SKF_AD_CPU);
+  else if (NIO_REUSEPORT_HASH == policy)
+    code[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                           SKF_AD_OFF + SKF_AD_RXHASH);
+  else
+    return -1;
+
+  /* the result indexes the group in the order its sockets were bound */
+  code[1] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, count - 1);
+  code[2] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+  prog.len = 3;
+  prog.filter = code;
+
+#if defined(SO_INCOMING_CPU)
+  if (NIO_REUSEPORT_CPU == policy)
+    for (i = 0; i < count; ++i)
+      setsockopt(listeners[i].sockfd, SOL_SOCKET, SO_INCOMING_CPU, (char *)&i,
+                 sizeof(i));
+#else
+  (void)i;
+#endif
+
+  /* the program is shared by the whole group, attaching once is enough */
+  return 0 == setsockopt(listeners[0].sockfd, SOL_SOCKET,
+                         SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))
+             ? 0
+             : -1;
+#else
+  (void)listeners;
+  (void)count;
+  (void)policy;
+  return -1;
+#endif
+}
+
+int nio_tcpfastopen(niosocket_t *s, int qlen) {
+#if defined(TCP_FASTOPEN)
+#if defined(__APPLE__)
+  /* Darwin only takes an on/off switch */
+  qlen = qlen > 0;
+#endif
+  return 0 == setsockopt(s->sockfd, IPPROTO_TCP, TCP_FASTOPEN, (char *)&qlen,
+                         sizeof(qlen))
+             ? 0
+             : -1;
+#else
+  (void)s;
+  (void)qlen;
+  return -1;
+#endif
+}
+
+int nio_connectfastopen(niosocket_t *s, const niosockaddr_t *addr,
+                        const void *data, int len) {
+#if defined(MSG_FASTOPEN)
+  /* data rides on the SYN when a cookie is cached, else after the handshake */
+  int sent = sendto(s->sockfd, (const char *)data, len, MSG_FASTOPEN,
+                    (struct sockaddr *)(&addr->saddr),
+                    socket_addrlen(&addr->saddr));
+
+  /* one syscall does both, so both probes see its result */
+  NIO_PROBE2(connect, s->sockfd, sent < 0 ? -1 : 0);
+  NIO_PROBE2(send, s->sockfd, sent);
+
+  if (sent >= 0)
+    return sent;
+  return nio_inprogress() ? 0 : -1;
+#elif defined(__APPLE__) && defined(CONNECT_DATA_IDEMPOTENT)
+  sa_endpoints_t endpoints;
+  struct iovec iov;
+  size_t sent = 0;
+  int retval;
+
+  memset(&endpoints, 0, sizeof(endpoints));
+  endpoints.sae_dstaddr = (struct sockaddr *)(&addr->saddr);
+  endpoints.sae_dstaddrlen = socket_addrlen(&addr->saddr);
+
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+
+  retval = connectx(s->sockfd, &endpoints, SAE_ASSOCID_ANY,
+                    CONNECT_DATA_IDEMPOTENT, &iov, 1, &sent, NULL);
+
+  NIO_PROBE2(connect, s->sockfd, retval);
+  NIO_PROBE2(send, s->sockfd, (int)sent);
+
+  if (0 == retval)
+    return (int)sent;
+  return nio_inprogress() ? (int)sent : -1;
+#else
+  if (0 != nio_connect(s, addr))
+    return nio_inprogress() ? 0 : -1;
+  return nio_send(s, data, len);
+#endif
+}
+
+int nio_deferaccept(niosocket_t *s, int seconds) {
+#if defined(TCP_DEFER_ACCEPT)
+  return 0 == setsockopt(s->sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                         (char *)&seconds, sizeof(seconds))
+             ? 0
+             : -1;
+#elif defined(SO_ACCEPTFILTER)
+  struct accept_filter_arg afa;
+
+  if (seconds <= 0)
+    return 0 == setsockopt(s->sockfd, SOL_SOCKET, SO_ACCEPTFILTER, NULL, 0)
+               ? 0
+               : -1;
+
+  /* no timeout knob, dataready holds connections until data arrives */
+  memset(&afa, 0, sizeof(afa));
+  strcpy(afa.af_name, "dataready");
+
+  return 0 == setsockopt(s->sockfd, SOL_SOCKET, SO_ACCEPTFILTER, &afa,
+                         sizeof(afa))
+             ? 0
+             : -1;
+#else
+  (void)s;
+  (void)seconds;
+  return -1;
+#endif
+}
+
+#if defined(__linux__) && defined(TCP_INFO)
+/* the kernel ABI, append only, libc headers often stop short of it */
+typedef struct socket_linuxtcpinfo_s {
+  unsigned char state, ca_state, retransmits, probes, backoff, options, wscale,
+      flags;
+  unsigned int rto, ato, snd_mss, rcv_mss;
+  unsigned int unacked, sacked, lost, retrans, fackets;
+  unsigned int last_data_sent, last_ack_sent, last_data_recv, last_ack_recv;
+  unsigned int pmtu, rcv_ssthresh, rtt, rttvar, snd_ssthresh, snd_cwnd;
+  unsigned int advmss, reordering, rcv_rtt, rcv_space, total_retrans;
+  unsigned long long pacing_rate, max_pacing_rate;
+  unsigned long long bytes_acked, bytes_received;
+  unsigned int segs_out, segs_in, notsent_bytes, min_rtt;
+  unsigned int data_segs_in, data_segs_out;
+  unsigned long long delivery_rate;
+} socket_linuxtcpinfo_t;
+
+#define socket_tcpinfohas(len, field)                                          \
+  ((len) >= offsetof(socket_linuxtcpinfo_t, field) +                           \
+                sizeof(((socket_linuxtcpinfo_t *)0)->field))
+#endif
+
+int nio_tcpinfo(niosocket_t *s, niotcpinfo_t *info) {
+#if defined(__linux__) && defined(TCP_INFO)
+  socket_linuxtcpinfo_t ti;
+  socklen_t len = sizeof(ti);
+
+  memset(&ti, 0, sizeof(ti));
+  memset(info, 0, sizeof(niotcpinfo_t));
+
+  if (0 != getsockopt(s->sockfd, IPPROTO_TCP, TCP_INFO, &ti, &len))
+    return -1;
+
+  info->established = TCP_ESTABLISHED == ti.state;
+  info->rtt = ti.rtt;
+  info->rttvar = ti.rttvar;
+  info->cwnd = ti.snd_cwnd;
+  info->mss = ti.snd_mss;
+  info->unacked = ti.unacked;
+  info->retransmits = ti.total_retrans;
+
+  /* older kernels return a shorter struct, missing fields stay 0 */
+  if (socket_tcpinfohas(len, pacing_rate))
+    info->pacingrate = ti.pacing_rate;
+  if (socket_tcpinfohas(len, bytes_acked))
+    info->bytesacked = ti.bytes_acked;
+  if (socket_tcpinfohas(len, min_rtt))
+    info->minrtt = ti.min_rtt;
+  if (socket_tcpinfohas(len, delivery_rate))
+    info->deliveryrate = ti.delivery_rate;
+
+  return 0;
+#elif defined(__APPLE__) && defined(TCP_CONNECTION_INFO)
+  struct tcp_connection_info ti;
+  socklen_t len = sizeof(ti);
+
+  memset(info, 0, sizeof(niotcpinfo_t));
+
+  if (0 != getsockopt(s->sockfd, IPPROTO_TCP, TCP_CONNECTION_INFO, &ti, &len))
+    return -1;
+
+  /* milliseconds and octets here, no pacing or delivery rate */
+  info->established = TCPS_ESTABLISHED == ti.tcpi_state;
+  info->rtt = ti.tcpi_srtt * 1000;
+  info->rttvar = ti.tcpi_rttvar * 1000;
+  info->mss = ti.tcpi_maxseg;
+  info->cwnd = ti.tcpi_maxseg ? ti.tcpi_snd_cwnd / ti.tcpi_maxseg : 0;
+  info->retransmits = (unsigned int)ti.tcpi_txretransmitpackets;
+
+  return 0;
+#elif defined(__FreeBSD__) && defined(TCP_INFO)
+  struct tcp_info ti;
+  socklen_t len = sizeof(ti);
+
+  memset(info, 0, sizeof(niotcpinfo_t));
+
+  if (0 != getsockopt(s->sockfd, IPPROTO_TCP, TCP_INFO, &ti, &len))
+    return -1;
+
+  info->established = TCPS_ESTABLISHED == ti.tcpi_state;
+  info->rtt = ti.tcpi_rtt;
+  info->rttvar = ti.tcpi_rttvar;
+  info->mss = ti.tcpi_snd_mss;
+  info->cwnd = ti.tcpi_snd_mss ? ti.tcpi_snd_cwnd / ti.tcpi_snd_mss : 0;
+  info->retransmits = ti.tcpi_snd_rexmitpack;
+
+  return 0;
+#else
+  (void)s;
+  memset(info, 0, sizeof(niotcpinfo_t));
+  return -1;
+#endif
+}
+
 int nio_udpbroadcast(niosocket_t *s, int on) {
   setsockopt(s->sockfd, SOL_SOCKET, SO_BROADCAST, (char *)&on, sizeof(on));
   return 0;
 }
 
-int nio_socketreadable(niosocket_t *s, unsigned int timedout) {
-  struct timeval tv = {0, 0};
-  fd_set fds, fd_error;
+#ifndef _WIN32
+static int socket_wait(niosocket_t *s, int writing, unsigned int timedout) {
+  struct pollfd pfd;
   int retval;
 
-  FD_ZERO(&fds);
-  FD_ZERO(&fd_error);
-  FD_SET(s->sockfd, &fds);
-  FD_SET(s->sockfd, &fd_error);
-
-  if (timedout > 0) {
-    tv.tv_sec = (long)(timedout * 0.001);
-    tv.tv_usec = (long)((timedout % 1000) * 1000);
-  }
+  pfd.fd = s->sockfd;
+  pfd.events = writing ? POLLOUT : POLLIN;
+  pfd.revents = 0;
 
-  retval = select(s->sockfd + 1, &fds, NULL, &fd_error, &tv);
+  /* poll has no FD_SETSIZE limit, UINT_MAX waits forever */
+  retval = poll(&pfd, 1,
+                (UINT_MAX == timedout) ? -1
+                : (timedout > INT_MAX) ? INT_MAX
+                                       : (int)timedout);
   if (retval < 0)
-    return -1;
+    return (EINTR == errno) ? 0 : -1;
 
   if (retval > 0) {
-    if (FD_ISSET(s->sockfd, &fd_error))
+    if (pfd.revents & (POLLERR | POLLNVAL))
       return -1;
 
-    if (FD_ISSET(s->sockfd, &fds))
-      return 1;
+    /* a hang up is reported as ready, the next call sees EOF or EPIPE */
+    return 1;
   }
   return 0;
 }
-
-int nio_socketwritable(niosocket_t *s, unsigned int timedout) {
-  struct timeval tv = {0, 0};
+#else
+static int socket_wait(niosocket_t *s, int writing, unsigned int timedout) {
+  struct timeval tv;
   fd_set fds, fd_error;
   int retval;
 
@@ -771,12 +1278,11 @@ int nio_socketwritable(niosocket_t *s, unsigned int timedout) {
   FD_SET(s->sockfd, &fds);
   FD_SET(s->sockfd, &fd_error);
 
-  if (timedout > 0) {
-    tv.tv_sec = (long)(timedout * 0.001);
-    tv.tv_usec = (long)((timedout % 1000) * 1000);
-  }
+  tv.tv_sec = (long)(timedout / 1000);
+  tv.tv_usec = (long)((timedout % 1000) * 1000);
 
-  retval = select(s->sockfd + 1, NULL, &fds, &fd_error, &tv);
+  retval = select(s->sockfd + 1, writing ? NULL : &fds, writing ? &fds : NULL,
+                  &fd_error, (UINT_MAX == timedout) ? NULL : &tv);
   if (retval < 0)
     return -1;
 
@@ -789,10 +1295,22 @@ int nio_socketwritable(niosocket_t *s, unsigned int timedout) {
   }
   return 0;
 }
+#endif
+
+int nio_socketreadable(niosocket_t *s, unsigned int timedout) {
+  return socket_wait(s, 0, timedout);
+}
+
+int nio_socketwritable(niosocket_t *s, unsigned int timedout) {
+  return socket_wait(s, 1, timedout);
+}
 
 int nio_send(niosocket_t *s, const void *buffer, int len) {
 #ifndef _WIN32
-  return send(s->sockfd, (const char *)buffer, len, 0);
+  int retval = (int)send(s->sockfd, (const char *)buffer, len, 0);
+
+  NIO_PROBE2(send, s->sockfd, retval);
+  return retval;
 #else
   DWORD num = 0;
   WSABUF wsa_buf = {(ULONG)len, (CHAR *)buffer};
@@ -805,7 +1323,10 @@ int nio_send(niosocket_t *s, const void *buffer, int len) {
 
 int nio_recv(niosocket_t *s, void *buffer, int len) {
 #ifndef _WIN32
-  return recv(s->sockfd, (char *)buffer, len, 0);
+  int retval = (int)recv(s->sockfd, (char *)buffer, len, 0);
+
+  NIO_PROBE2(recv, s->sockfd, retval);
+  return retval;
 #else
   DWORD num = 0, flag = 0;
   WSABUF wsa_buf = {(ULONG)len, (CHAR *)buffer};
@@ -816,18 +1337,51 @@ int nio_recv(niosocket_t *s, void *buffer, int len) {
 #endif
 }
 
+int nio_sendv(niosocket_t *s, const nioiobuf_t *bufs, int count) {
+#ifndef _WIN32
+  nio_dynarray(struct iovec, iov, count);
+  int i, retval;
+
+  for (i = 0; i < count; ++i) {
+    iov[i].iov_base = (void *)bufs[i].data;
+    iov[i].iov_len = (size_t)bufs[i].len;
+  }
+  retval = (int)writev(s->sockfd, iov, count);
+
+  NIO_PROBE2(send, s->sockfd, retval);
+  return retval;
+#else
+  DWORD num = 0;
+  nio_dynarray(WSABUF, wsa_bufs, count);
+  int i;
+
+  for (i = 0; i < count; ++i) {
+    wsa_bufs[i].len = (ULONG)bufs[i].len;
+    wsa_bufs[i].buf = (CHAR *)bufs[i].data;
+  }
+
+  if (SOCKET_ERROR == WSASend(s->sockfd, wsa_bufs, count, &num, 0, NULL, NULL))
+    return -1;
+  return (int)num;
+#endif
+}
+
 int nio_sendto(niosocket_t *s, const niosockaddr_t *addr, const void *buffer,
                int len) {
 #ifndef _WIN32
-  return sendto(s->sockfd, (const char *)buffer, len, 0,
-                (struct sockaddr *)(&addr->saddr), sockaddr_len(&addr->saddr));
+  int retval = (int)sendto(s->sockfd, (const char *)buffer, len, 0,
+                           (struct sockaddr *)(&addr->saddr),
+                           socket_addrlen(&addr->saddr));
+
+  NIO_PROBE2(send, s->sockfd, retval);
+  return retval;
 #else
   DWORD num = 0;
   WSABUF wsa_buf = {(ULONG)len, (CHAR *)buffer};
 
   if (SOCKET_ERROR == WSASendTo(s->sockfd, &wsa_buf, 1, &num, 0,
                                 (struct sockaddr *)(&addr->saddr),
-                                sockaddr_len(&addr->saddr), NULL, NULL))
+                                socket_addrlen(&addr->saddr), NULL, NULL))
     return -1;
   return (int)num;
 #endif
@@ -838,9 +1392,13 @@ int nio_recvfrom(niosocket_t *s, niosockaddr_t *addr, void *buffer, int len) {
   socklen_t size = sizeof(ss);
   int num = 0;
 
+  /* AF_UNIX senders may fill in fewer octets than the storage holds */
+  memset(&ss, 0, sizeof(ss));
+
 #ifndef _WIN32
   num = recvfrom(s->sockfd, (char *)buffer, len, 0, (struct sockaddr *)&ss,
                  &size);
+  NIO_PROBE2(recv, s->sockfd, num);
 #else
   DWORD flag = 0, rd_num = 0;
   WSABUF wsa_buf = {(ULONG)len, (CHAR *)buffer};
@@ -858,58 +1416,312 @@ int nio_recvfrom(niosocket_t *s, niosockaddr_t *addr, void *buffer, int len) {
   return num;
 }
 
+#define NIO_NODEADLINE (~0ULL)
+
+static unsigned int deadline_remaining(unsigned long long deadline) {
+  unsigned long long now;
+
+  if (NIO_NODEADLINE == deadline)
+    return UINT_MAX;
+
+  now = nio_millisec();
+  if (now >= deadline)
+    return 0;
+
+  return (deadline - now >= UINT_MAX) ? UINT_MAX - 1
+                                      : (unsigned int)(deadline - now);
+}
+
+/* never blocks, even on a blocking socket, -1 with EAGAIN when not ready */
+static int socket_trysend(niosocket_t *s, const void *buffer, int len) {
+#ifndef _WIN32
+  int retval = (int)send(s->sockfd, (const char *)buffer, len, MSG_DONTWAIT);
+
+  NIO_PROBE2(send, s->sockfd, retval);
+  return retval;
+#else
+  if (socket_wait(s, 1, 0) <= 0) {
+    WSASetLastError(WSAEWOULDBLOCK);
+    return -1;
+  }
+  return nio_send(s, buffer, len);
+#endif
+}
+
+static int socket_tryrecv(niosocket_t *s, void *buffer, int len) {
+#ifndef _WIN32
+  int retval = (int)recv(s->sockfd, (char *)buffer, len, MSG_DONTWAIT);
+
+  NIO_PROBE2(recv, s->sockfd, retval);
+  return retval;
+#else
+  if (socket_wait(s, 0, 0) <= 0) {
+    WSASetLastError(WSAEWOULDBLOCK);
+    return -1;
+  }
+  return nio_recv(s, buffer, len);
+#endif
+}
+
 int nio_sendall(niosocket_t *s, const void *buffer, int len) {
+  return nio_sendalldeadline(s, buffer, len, NIO_NODEADLINE);
+}
+
+int nio_recvall(niosocket_t *s, void *buffer, int len) {
+  return nio_recvalldeadline(s, buffer, len, NIO_NODEADLINE);
+}
+
+int nio_sendalldeadline(niosocket_t *s, const void *buffer, int len,
+                        unsigned long long deadline) {
   unsigned char *lptr = (unsigned char *)buffer;
+  unsigned int remaining;
   int sent = 0;
   int retval = 0;
 
+  /* a blocking call could outlive the deadline, only wait in poll */
   while (sent < len) {
-    retval = nio_send(s, lptr, len - sent);
+    retval = socket_trysend(s, lptr, len - sent);
 
-    if (retval >= 0) {
+    if (retval > 0) {
       sent += retval;
       lptr += retval;
-    } else {
-      if (!nio_inprogress())
-        return -1;
+      continue;
     }
 
-    if (sent != len)
-      if (nio_socketwritable(s, UINT_MAX) < 0)
-        return -1;
+    if (retval < 0 && !nio_inprogress())
+      return -1;
+
+    remaining = deadline_remaining(deadline);
+    if (0 == remaining)
+      return sent; /* timed out */
+
+    if (nio_socketwritable(s, remaining) < 0)
+      return -1;
   }
 
   return sent;
 }
 
-int nio_recvall(niosocket_t *s, void *buffer, int len) {
+int nio_recvalldeadline(niosocket_t *s, void *buffer, int len,
+                        unsigned long long deadline) {
   unsigned char *lptr = (unsigned char *)buffer;
+  unsigned int remaining;
   int total = 0;
   int retval = 0;
 
   while (total < len) {
-    retval = nio_recv(s, lptr, len - total);
+    retval = socket_tryrecv(s, lptr, len - total);
 
     if (retval > 0) {
       total += retval;
       lptr += retval;
-    } else {
-      if (0 == retval)
-        return total; /* disconnected */
+      continue;
+    }
+
+    if (0 == retval)
+      return total; /* disconnected */
+
+    if (!nio_inprogress())
+      return -1;
+
+    remaining = deadline_remaining(deadline);
+    if (0 == remaining)
+      return total; /* timed out */
+
+    if (nio_socketreadable(s, remaining) < 0)
+      return -1;
+  }
+
+  return total;
+}
+
+#ifndef _WIN32
+int nio_sendfds(niosocket_t *s, const int *fds, int count, const void *data,
+                int len) {
+  nio_dynarray(char, control, CMSG_SPACE(sizeof(int) * NIO_MAXFDS));
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  char octet = 0;
+  int retval;
+
+  if (count <= 0 || count > NIO_MAXFDS || len < 0)
+    return -1;
+
+  /* ancillary data rides on at least one octet of real data */
+  iov.iov_base = len > 0 ? (void *)data : &octet;
+  iov.iov_len = len > 0 ? (size_t)len : 1;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+  memset(control, 0, msg.msg_controllen);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+  retval = (int)sendmsg(s->sockfd, &msg, 0);
+
+  NIO_PROBE2(send, s->sockfd, retval);
+  return retval;
+}
+
+int nio_recvfds(niosocket_t *s, int *fds, int *count, void *data, int len) {
+  nio_dynarray(char, control, CMSG_SPACE(sizeof(int) * NIO_MAXFDS));
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  int i, n, received = 0, dropped = 0, flags = 0, retval;
+  char octet;
+
+  iov.iov_base = len > 0 ? data : &octet;
+  iov.iov_len = len > 0 ? (size_t)len : 1;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * NIO_MAXFDS);
+
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+  retval = (int)recvmsg(s->sockfd, &msg, flags);
+
+  NIO_PROBE2(recv, s->sockfd, retval);
+  if (retval < 0)
+    return -1;
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type)
+      continue;
+
+    n = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+
+    /* whatever does not fit is closed, never leaked into the process */
+    for (i = 0; i < n; ++i) {
+      int fd;
+
+      memcpy(&fd, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+#ifndef MSG_CMSG_CLOEXEC
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+      if (received < *count)
+        fds[received++] = fd;
       else {
-        if (!nio_inprogress())
-          return -1;
+        close(fd);
+        dropped = 1;
       }
     }
+  }
 
-    if (total != len)
-      if (nio_socketreadable(s, UINT_MAX) < 0)
-        return -1;
+  /* a partial set is useless for a handoff, drop it all */
+  if ((msg.msg_flags & MSG_CTRUNC) || dropped) {
+    for (i = 0; i < received; ++i)
+      close(fds[i]);
+    *count = 0;
+    return -1;
   }
 
-  return total;
+  *count = received;
+  return retval;
+}
+
+int nio_sendsockets(niosocket_t *s, const niosocket_t *socks, int count) {
+  int fds[NIO_MAXFDS];
+  unsigned int remaining;
+  int i, batch, sent = 0;
+
+  if (count <= 0)
+    return -1;
+
+  /* each message says how many sockets are still to come, itself included */
+  while (sent < count) {
+    batch = count - sent > NIO_MAXFDS ? NIO_MAXFDS : count - sent;
+    remaining = (unsigned int)(count - sent);
+
+    for (i = 0; i < batch; ++i)
+      fds[i] = socks[sent + i].sockfd;
+
+    if (nio_sendfds(s, fds, batch, &remaining, sizeof(remaining)) !=
+        sizeof(remaining))
+      return -1;
+
+    sent += batch;
+  }
+
+  return sent;
+}
+
+int nio_recvsockets(niosocket_t *s, niosocket_t *socks, int count) {
+  int fds[NIO_MAXFDS];
+  unsigned int remaining;
+  int i, batch, received = 0;
+
+  do {
+    batch = NIO_MAXFDS;
+
+    if (nio_recvfds(s, fds, &batch, &remaining, sizeof(remaining)) !=
+            sizeof(remaining) ||
+        0 == batch || remaining < (unsigned int)batch)
+      goto error;
+
+    for (i = 0; i < batch; ++i) {
+      if (received < count)
+        socks[received++].sockfd = fds[i];
+      else
+        close(fds[i]);
+    }
+  } while (remaining > (unsigned int)batch);
+
+  return received;
+
+error:
+  for (i = 0; i < received; ++i)
+    nio_destroysocket(&socks[i]);
+  return -1;
+}
+#else
+int nio_sendfds(niosocket_t *s, const int *fds, int count, const void *data,
+                int len) {
+  (void)s;
+  (void)fds;
+  (void)count;
+  (void)data;
+  (void)len;
+  return -1;
+}
+
+int nio_recvfds(niosocket_t *s, int *fds, int *count, void *data, int len) {
+  (void)s;
+  (void)fds;
+  (void)count;
+  (void)data;
+  (void)len;
+  return -1;
 }
 
+int nio_sendsockets(niosocket_t *s, const niosocket_t *socks, int count) {
+  (void)s;
+  (void)socks;
+  (void)count;
+  return -1;
+}
+
+int nio_recvsockets(niosocket_t *s, niosocket_t *socks, int count) {
+  (void)s;
+  (void)socks;
+  (void)count;
+  return -1;
+}
+#endif
+
 static void ip4_mreq(struct ip_mreq *mreq4,
                      const struct sockaddr_storage *ipaddr) {
   struct sockaddr_in *ss_addr = (struct sockaddr_in *)ipaddr;
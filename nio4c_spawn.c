@@ -0,0 +1,191 @@
+/*
+ *  nio4c_spawn.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+extern char **environ;
+
+static int spawn_pidfd(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  /* readable once the child exits, Linux 5.3+ */
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+static int spawn_pipe(niosocket_t *parent, niosocket_t *child) {
+  niosocket_t socks[2];
+
+  /* dup2 in the child clears FD_CLOEXEC on the stdio copies */
+#ifdef SOCK_CLOEXEC
+  /* atomic, a fork on another thread can not inherit them in between */
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    return -1;
+
+  socks[0].sockfd = sv[0];
+  socks[1].sockfd = sv[1];
+#else
+  if (0 != nio_pipe(socks))
+    return -1;
+
+  fcntl(socks[0].sockfd, F_SETFD, FD_CLOEXEC);
+  fcntl(socks[1].sockfd, F_SETFD, FD_CLOEXEC);
+#endif
+  nio_socketnonblock(&socks[0], 1);
+
+  *parent = socks[0];
+  *child = socks[1];
+
+  return 0;
+}
+
+static void spawn_init(nioprocess_t *proc) {
+  proc->pid = -1;
+  nio_initsocket(&proc->in);
+  nio_initsocket(&proc->out);
+  nio_initsocket(&proc->err);
+  nio_initsocket(&proc->exit);
+}
+
+int nio_spawn(nioprocess_t *proc, const char *file, char *const argv[],
+              char *const envp[]) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  niosocket_t child[3];
+  sigset_t sigmask, sigdefault;
+  pid_t pid;
+  int i, error, retval = -1;
+
+  spawn_init(proc);
+
+  for (i = 0; i < 3; ++i)
+    nio_initsocket(&child[i]);
+
+  if (0 != spawn_pipe(&proc->in, &child[0]) ||
+      0 != spawn_pipe(&proc->out, &child[1]) ||
+      0 != spawn_pipe(&proc->err, &child[2]))
+    goto cleanup;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, child[0].sockfd, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, child[1].sockfd, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, child[2].sockfd, STDERR_FILENO);
+
+  /* signals blocked for selector_watchsignal must not stay blocked */
+  posix_spawnattr_init(&attr);
+  sigemptyset(&sigmask);
+  posix_spawnattr_setsigmask(&attr, &sigmask);
+
+  /* SIG_IGN survives exec, nio_initialize ignores SIGPIPE for us only */
+  sigemptyset(&sigdefault);
+  sigaddset(&sigdefault, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attr, &sigdefault);
+
+  posix_spawnattr_setflags(&attr,
+                           POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  /* no fork, glibc and the BSDs use vfork semantics without page copies */
+  error = posix_spawnp(&pid, file, &actions, &attr, argv,
+                       envp ? envp : environ);
+
+  if (0 == error) {
+    proc->pid = (int)pid;
+    proc->exit.sockfd = spawn_pidfd(pid);
+    retval = 0;
+  } else
+    errno = error; /* posix_spawnp returns it instead of setting errno */
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+cleanup:
+  for (i = 0; i < 3; ++i)
+    nio_destroysocket(&child[i]);
+
+  if (0 != retval)
+    nio_destroyprocess(proc);
+
+  return retval;
+}
+
+int nio_reap(nioprocess_t *proc, int *status, int block) {
+  int wstatus;
+  pid_t pid;
+
+  if (proc->pid <= 0)
+    return -1;
+
+  do {
+    pid = waitpid((pid_t)proc->pid, &wstatus, block ? 0 : WNOHANG);
+  } while (pid < 0 && EINTR == errno);
+
+  if (pid < 0)
+    return -1;
+
+  if (0 == pid)
+    return 0;
+
+  if (status)
+    *status = WIFEXITED(wstatus)     ? WEXITSTATUS(wstatus)
+              : WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus)
+                                     : -1;
+
+  proc->pid = -1;
+  return 1;
+}
+
+void nio_destroyprocess(nioprocess_t *proc) {
+  nio_destroysocket(&proc->in);
+  nio_destroysocket(&proc->out);
+  nio_destroysocket(&proc->err);
+
+  if (INVALID_SOCKET != proc->exit.sockfd)
+    close(proc->exit.sockfd);
+  nio_initsocket(&proc->exit);
+}
+#else
+int nio_spawn(nioprocess_t *proc, const char *file, char *const argv[],
+              char *const envp[]) {
+  (void)file;
+  (void)argv;
+  (void)envp;
+
+  proc->pid = -1;
+  nio_initsocket(&proc->in);
+  nio_initsocket(&proc->out);
+  nio_initsocket(&proc->err);
+  nio_initsocket(&proc->exit);
+
+  return -1;
+}
+
+int nio_reap(nioprocess_t *proc, int *status, int block) {
+  (void)proc;
+  (void)status;
+  (void)block;
+  return -1;
+}
+
+void nio_destroyprocess(nioprocess_t *proc) { (void)proc; }
+#endif
@@ -0,0 +1,175 @@
+/*
+ *  nio4c_tcpsampler.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+#include <string.h>
+
+typedef struct niotcpsample_s {
+  niomonitor_t *monitor;
+  niotcpinfo_t info;
+} niotcpsample_t;
+
+struct niotcpsampler_s {
+  nioselector_t *selector;
+  niotimer_t timer;
+  unsigned int interval;
+  nio_tcpsamplecallback callback;
+  void *ud;
+  niotcpaggregate_t last;
+  niotcpsample_t *samples;
+  int capacity;
+  int dispatching;
+  int destroyed;
+  int stopped;
+};
+
+static void tcpsampler_free(niotcpsampler_t *sampler) {
+  if (sampler->samples)
+    nio_free(sampler->samples);
+  nio_free(sampler);
+}
+
+static int tcpsampler_collect(niotcpsampler_t *sampler) {
+  niohtable_t *selectables = &sampler->selector->selectables;
+  niotcpsample_t *samples;
+  niomonitor_t *monitor;
+  niohtableiter_t iter;
+  int count = 0;
+
+  if (selectables->used > sampler->capacity) {
+    samples = (niotcpsample_t *)nio_realloc(
+        sampler->samples,
+        (int)nio_nextpower(selectables->used) * sizeof(niotcpsample_t));
+    if (!samples)
+      return -1;
+
+    sampler->samples = samples;
+    sampler->capacity = (int)nio_nextpower(selectables->used);
+  }
+
+  /* non TCP sockets and listeners fall out here */
+  niohtable_iter(selectables, &iter);
+  while (0 == niohtable_next(&iter, NULL, &monitor)) {
+    if (monitor->handler || monitor_closed(monitor))
+      continue;
+
+    if (0 != nio_tcpinfo(monitor->io, &sampler->samples[count].info) ||
+        !sampler->samples[count].info.established)
+      continue;
+
+    sampler->samples[count++].monitor = monitor;
+  }
+
+  return count;
+}
+
+static void tcpsampler_aggregate(niotcpsampler_t *sampler, int count) {
+  niotcpaggregate_t *last = &sampler->last;
+  unsigned long long rtts = 0;
+  niotcpinfo_t *info;
+  int i;
+
+  memset(last, 0, sizeof(niotcpaggregate_t));
+  last->sampled = nio_millisec();
+  last->connections = count;
+
+  for (i = 0; i < count; ++i) {
+    info = &sampler->samples[i].info;
+
+    if (0 == i || info->rtt < last->minrtt)
+      last->minrtt = info->rtt;
+    if (info->rtt > last->maxrtt)
+      last->maxrtt = info->rtt;
+
+    rtts += info->rtt;
+    last->retransmits += info->retransmits;
+    last->deliveryrate += info->deliveryrate;
+  }
+
+  if (count > 0)
+    last->avgrtt = (unsigned int)(rtts / count);
+}
+
+static void tcpsampler_run(niotimer_t *timer) {
+  niotcpsampler_t *sampler = nio_entry(timer, niotcpsampler_t, timer);
+  int i, count;
+
+  count = tcpsampler_collect(sampler);
+  if (count < 0)
+    count = 0;
+
+  tcpsampler_aggregate(sampler, count);
+
+  /* snapshot first, handlers must not be called with the table half walked */
+  if (sampler->callback) {
+    sampler->dispatching = 1;
+
+    /* an earlier callback may have closed a later monitor, selector_select
+     * keeps its memory until it returns */
+    for (i = 0; i < count && !sampler->destroyed; ++i)
+      if (!monitor_closed(sampler->samples[i].monitor))
+        sampler->callback(sampler->ud, sampler->samples[i].monitor,
+                          &sampler->samples[i].info);
+
+    sampler->dispatching = 0;
+  }
+
+  if (sampler->destroyed) {
+    tcpsampler_free(sampler);
+    return;
+  }
+
+  /* no next round, tcpsampler_last must not pass this one off as current */
+  if (0 != selector_addtimer(sampler->selector, &sampler->timer,
+                             sampler->interval))
+    sampler->stopped = 1;
+}
+
+niotcpsampler_t *nio_tcpsampler(nioselector_t *selector, unsigned int interval,
+                                nio_tcpsamplecallback callback, void *ud) {
+  niotcpsampler_t *sampler;
+
+  if (0 == interval || selector_closed(selector))
+    return NULL;
+
+  sampler = (niotcpsampler_t *)nio_calloc(1, sizeof(niotcpsampler_t));
+  if (!sampler)
+    return NULL;
+
+  sampler->selector = selector;
+  sampler->interval = interval;
+  sampler->callback = callback;
+  sampler->ud = ud;
+
+  niotimer_init(&sampler->timer, tcpsampler_run);
+
+  if (0 != selector_addtimer(selector, &sampler->timer, interval)) {
+    nio_free(sampler);
+    return NULL;
+  }
+
+  return sampler;
+}
+
+void tcpsampler_destroy(niotcpsampler_t *sampler) {
+  selector_canceltimer(sampler->selector, &sampler->timer);
+
+  /* the sample callback may destroy its own sampler */
+  if (sampler->dispatching)
+    sampler->destroyed = 1;
+  else
+    tcpsampler_free(sampler);
+}
+
+int tcpsampler_last(niotcpsampler_t *sampler, niotcpaggregate_t *aggregate) {
+  memcpy(aggregate, &sampler->last, sizeof(niotcpaggregate_t));
+  return sampler->last.sampled && !sampler->stopped ? 0 : -1;
+}
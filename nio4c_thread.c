@@ -0,0 +1,155 @@
+/*
+ *  nio4c_thread.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <signal.h>
+#endif
+
+typedef struct niothreadarg_s {
+  void (*func)(void *);
+  void *arg;
+} niothreadarg_t;
+
+#ifdef _WIN32
+static unsigned int __stdcall thread_entry(void *arg) {
+#else
+static void *thread_entry(void *arg) {
+#endif
+  niothreadarg_t targ = *(niothreadarg_t *)arg;
+
+  nio_free(arg);
+  targ.func(targ.arg);
+
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+int niothread_create(niothread_t *thread, void (*func)(void *), void *arg) {
+  niothreadarg_t *targ = (niothreadarg_t *)nio_malloc(sizeof(niothreadarg_t));
+  if (!targ)
+    return -1;
+
+  targ->func = func;
+  targ->arg = arg;
+
+#ifdef _WIN32
+  *thread = (HANDLE)_beginthreadex(NULL, 0, thread_entry, targ, 0, NULL);
+  if (*thread)
+    return 0;
+#else
+  {
+    sigset_t all, saved;
+    int retval;
+
+    /* workers inherit a full mask, signals stay with application threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    retval = pthread_create(thread, NULL, thread_entry, targ);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (0 == retval)
+      return 0;
+  }
+#endif
+
+  nio_free(targ);
+  return -1;
+}
+
+void niothread_join(niothread_t thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+int niomutex_init(niomutex_t *mutex) {
+#ifdef _WIN32
+  InitializeCriticalSection(mutex);
+  return 0;
+#else
+  return 0 == pthread_mutex_init(mutex, NULL) ? 0 : -1;
+#endif
+}
+
+void niomutex_destroy(niomutex_t *mutex) {
+#ifdef _WIN32
+  DeleteCriticalSection(mutex);
+#else
+  pthread_mutex_destroy(mutex);
+#endif
+}
+
+void niomutex_lock(niomutex_t *mutex) {
+#ifdef _WIN32
+  EnterCriticalSection(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+void niomutex_unlock(niomutex_t *mutex) {
+#ifdef _WIN32
+  LeaveCriticalSection(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+int niocond_init(niocond_t *cond) {
+#ifdef _WIN32
+  InitializeConditionVariable(cond);
+  return 0;
+#else
+  return 0 == pthread_cond_init(cond, NULL) ? 0 : -1;
+#endif
+}
+
+void niocond_destroy(niocond_t *cond) {
+#ifdef _WIN32
+  ((void)cond);
+#else
+  pthread_cond_destroy(cond);
+#endif
+}
+
+void niocond_wait(niocond_t *cond, niomutex_t *mutex) {
+#ifdef _WIN32
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+  pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void niocond_signal(niocond_t *cond) {
+#ifdef _WIN32
+  WakeConditionVariable(cond);
+#else
+  pthread_cond_signal(cond);
+#endif
+}
+
+void niocond_broadcast(niocond_t *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(cond);
+#else
+  pthread_cond_broadcast(cond);
+#endif
+}
@@ -0,0 +1,143 @@
+/*
+ *  nio4c_timer.c
+ *
+ *  copyright (c) 2019, 2020 Xiongfei Shi
+ *
+ *  author: Xiongfei Shi <xiongfei.shi(a)icloud.com>
+ *  license: Apache-2.0
+ *
+ *  https://github.com/shixiongfei/nio4c
+ */
+
+#include "nio4c_internal.h"
+
+#define TIMER_INITSIZE 16
+
+/* binary min-heap ordered by expiry, each timer remembers its slot */
+
+static void timer_place(nioselector_t *selector, niotimer_t *timer, int index) {
+  selector->timers[index] = timer;
+  timer->index = index;
+}
+
+static void timer_siftup(nioselector_t *selector, int index) {
+  niotimer_t *timer = selector->timers[index];
+  int parent;
+
+  while (index > 0) {
+    parent = (index - 1) / 2;
+
+    if (selector->timers[parent]->expires <= timer->expires)
+      break;
+
+    timer_place(selector, selector->timers[parent], index);
+    index = parent;
+  }
+  timer_place(selector, timer, index);
+}
+
+static void timer_siftdown(nioselector_t *selector, int index) {
+  niotimer_t *timer = selector->timers[index];
+  int child;
+
+  while ((child = index * 2 + 1) < selector->ntimers) {
+    if (child + 1 < selector->ntimers &&
+        selector->timers[child + 1]->expires < selector->timers[child]->expires)
+      child += 1;
+
+    if (timer->expires <= selector->timers[child]->expires)
+      break;
+
+    timer_place(selector, selector->timers[child], index);
+    index = child;
+  }
+  timer_place(selector, timer, index);
+}
+
+void niotimer_init(niotimer_t *timer, void (*run)(niotimer_t *timer)) {
+  timer->run = run;
+  timer->expires = 0;
+  timer->index = -1;
+}
+
+int selector_addtimer(nioselector_t *selector, niotimer_t *timer,
+                      unsigned int millisec) {
+  niotimer_t **timers;
+  int capacity;
+
+  if (timer->index >= 0)
+    selector_canceltimer(selector, timer);
+
+  if (selector->ntimers >= selector->timercap) {
+    capacity = selector->timercap ? selector->timercap * 2 : TIMER_INITSIZE;
+    timers = (niotimer_t **)nio_realloc(selector->timers,
+                                        capacity * sizeof(niotimer_t *));
+    if (!timers)
+      return -1;
+
+    selector->timers = timers;
+    selector->timercap = capacity;
+  }
+
+  timer->expires = nio_microtime() / 1000 + millisec;
+
+  selector->timers[selector->ntimers] = timer;
+  selector->ntimers += 1;
+  timer_siftup(selector, selector->ntimers - 1);
+
+  return 0;
+}
+
+void selector_canceltimer(nioselector_t *selector, niotimer_t *timer) {
+  int index = timer->index;
+
+  if (index < 0)
+    return;
+
+  timer->index = -1;
+  selector->ntimers -= 1;
+
+  if (index == selector->ntimers)
+    return;
+
+  timer_place(selector, selector->timers[selector->ntimers], index);
+  timer_siftdown(selector, index);
+  timer_siftup(selector, index);
+}
+
+int selector_timeractive(niotimer_t *timer) { return timer->index >= 0; }
+
+int selector_nexttimeout(nioselector_t *selector, int timeout) {
+  unsigned long long now;
+  niotimer_t *timer;
+  int wait;
+
+  if (0 == selector->ntimers || 0 == timeout)
+    return timeout;
+
+  timer = selector->timers[0];
+  now = nio_microtime() / 1000;
+  wait = (timer->expires > now) ? (int)(timer->expires - now) : 0;
+
+  return (timeout < 0 || wait < timeout) ? wait : timeout;
+}
+
+int selector_runtimers(nioselector_t *selector) {
+  unsigned long long now = nio_microtime() / 1000;
+  niotimer_t *timer;
+  int count = 0;
+
+  while (selector->ntimers > 0) {
+    timer = selector->timers[0];
+
+    if (timer->expires > now)
+      break;
+
+    /* run may re-arm or cancel other timers */
+    selector_canceltimer(selector, timer);
+    timer->run(timer);
+    count += 1;
+  }
+
+  return count;
+}
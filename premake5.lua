@@ -1,3 +1,8 @@
+newoption {
+  trigger = "usdt",
+  description = "Build with USDT probes, needs sys/sdt.h (systemtap-sdt-dev)"
+}
+
 solution ( "nio4c" )
   configurations { "Release", "Debug" }
   platforms { "x64" }
@@ -29,6 +34,10 @@ solution ( "nio4c" )
   defines { "_UNICODE", "NIO_BUILD_DLL" }
   staticruntime "On"
 
+  if _OPTIONS["usdt"] then
+    defines { "NIO_USDT" }
+  end
+
   configuration ( "Release" )
     optimize "On"
     objdir ( "./bin/tmp" )
@@ -56,10 +65,11 @@ solution ( "nio4c" )
 
   configuration { "gmake", "linux" }
     defines { "__linux__" }
-    links { "m" }
+    links { "m", "pthread" }
 
   configuration { "gmake", "bsd" }
     defines { "__BSD__" }
+    links { "pthread" }
 
   -- A project defines one build target
   project ( "test" )
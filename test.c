@@ -10,7 +10,1623 @@
  */
 
 #include "nio4c.h"
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+static int failures = 0;
+
+static void check(int passed, const char *what) {
+  printf("%s: %s\n", what, passed ? "ok" : "FAILED");
+
+  if (!passed)
+    failures += 1;
+}
+
+/* RFC 1071 one 16-bit word at a time, in host order like nio_checksum */
+static unsigned short refchecksum(const unsigned char *data, int len) {
+  unsigned long sum = 0;
+  unsigned short word;
+  unsigned char pad[2] = {0, 0};
+  int i;
+
+  for (i = 0; i + 1 < len; i += 2) {
+    memcpy(&word, data + i, 2);
+    sum += word;
+  }
+
+  if (len & 1) {
+    pad[0] = data[len - 1];
+    memcpy(&word, pad, 2);
+    sum += word;
+  }
+
+  while (sum >> 16)
+    sum = (sum >> 16) + (sum & 0xFFFF);
+
+  return (unsigned short)sum;
+}
+
+static void test_checksum(void) {
+  static unsigned char data[4096 + 64];
+  int offset, len, same = 1;
+
+  srand(20200101);
+  for (len = 0; len < (int)sizeof(data); ++len)
+    data[len] = (unsigned char)rand();
+
+  /* every alignment against the short tails and the wide loops */
+  for (offset = 0; offset < 16; ++offset) {
+    for (len = 0; len <= 300; ++len)
+      if (nio_checksum(data + offset, len) != refchecksum(data + offset, len))
+        same = 0;
+
+    for (len = 1400; len <= 4096; len += 383)
+      if (nio_checksum(data + offset, len) != refchecksum(data + offset, len))
+        same = 0;
+  }
+  check(same, "checksum matches the reference");
+
+  memset(data, 0xFF, sizeof(data));
+  check(nio_checksum(data, 4096) == refchecksum(data, 4096),
+        "checksum carries on all ones");
+}
+
+static void test_checksumupdate(void) {
+  static unsigned char data[2048], copy[2048 + 8], patch[64];
+  unsigned short sum;
+  int i, offset, len, same = 1;
+
+  for (i = 0; i < (int)sizeof(data); ++i)
+    data[i] = (unsigned char)rand();
+
+  /* incremental update equals a full recompute, odd lengths included */
+  for (offset = 0; offset < 512; offset += 2) {
+    len = 1 + rand() % (int)sizeof(patch);
+
+    for (i = 0; i < len; ++i)
+      patch[i] = (unsigned char)rand();
+
+    sum = nio_checksum(data, sizeof(data));
+    sum = nio_checksumupdate(sum, data + offset, patch, len);
+    memcpy(data + offset, patch, len);
+
+    if (sum != nio_checksum(data, sizeof(data)))
+      same = 0;
+  }
+  check(same, "checksumupdate matches a recompute");
+
+  same = 1;
+  for (offset = 0; offset < 8; ++offset)
+    for (len = 0; len <= 1500; len += 1 + len / 8) {
+      memset(copy, 0, sizeof(copy));
+
+      if (nio_copychecksum(copy + offset, data + 1, len) !=
+              nio_checksum(data + 1, len) ||
+          0 != memcmp(copy + offset, data + 1, len))
+        same = 0;
+    }
+  check(same, "copychecksum copies and sums");
+}
+
+static void test_frames(void) {
+  static const int lensizes[] = {2, 4, 8};
+  static const int sizes[] = {0, 1, 300, 5000};
+  static char data[5000];
+  niosocket_t pipes[2];
+  niochannel_t *writer, *reader;
+  nioframing_t framing;
+  nioslice_t frame;
+  int i, j, k, got, retval, same = 1;
+
+  nio_pipe(pipes);
+  nio_socketnonblock(&pipes[0], 1);
+  nio_socketnonblock(&pipes[1], 1);
+
+  writer = nio_channel(&pipes[0], NULL);
+  reader = nio_channel(&pipes[1], NULL);
+
+  for (i = 0; i < 3; ++i) {
+    framing.lensize = lensizes[i];
+    framing.byteorder = (i & 1) ? NIO_LILENDIAN : NIO_BIGENDIAN;
+    framing.maxsize = sizeof(data);
+
+    for (j = 0; j < 4; ++j) {
+      memset(data, 'a' + j, sizes[j]);
+      channel_writeframe(writer, &framing, data, sizes[j]);
+    }
+
+    for (got = 0, k = 0; got < 4 && k < 100; ++k) {
+      channel_flush(writer);
+      channel_read(reader);
+
+      while (1 == (retval = channel_readframe(reader, &framing, &frame))) {
+        if (frame.len != sizes[got] ||
+            (frame.len > 0 &&
+             'a' + got != ((const char *)frame.data)[frame.len - 1]))
+          same = 0;
+        got += 1;
+      }
+
+      if (retval < 0)
+        break;
+    }
+
+    if (4 != got)
+      same = 0;
+  }
+  check(same, "frames round trip");
+
+  /* a big-endian "hello" one octet at a time, ready only at the last */
+  framing.lensize = 4;
+  framing.byteorder = NIO_BIGENDIAN;
+  framing.maxsize = 16;
+
+  same = 1;
+  for (i = 0; i < 9; ++i) {
+    nio_send(&pipes[0], &"\0\0\0\5hello"[i], 1);
+    channel_read(reader);
+
+    if ((8 == i) != (1 == channel_readframe(reader, &framing, &frame)))
+      same = 0;
+  }
+  check(same && 5 == frame.len && 0 == memcmp(frame.data, "hello", 5),
+        "frames wait for partial input");
+
+  nio_send(&pipes[0], "\0\0\0\x20", 4);
+  channel_read(reader);
+  check(-1 == channel_readframe(reader, &framing, &frame),
+        "frames reject oversized lengths");
+
+  channel_destroy(writer);
+  channel_destroy(reader);
+  nio_destroysocket(&pipes[0]);
+  nio_destroysocket(&pipes[1]);
+}
+
+static void test_records(void) {
+  static const char *chunks[] = {"GET / HTTP/1.1\r\n\r\npar", "tial\r",
+                                 "\n", "a\rb\r\n"};
+  static const char *expected[] = {"GET / HTTP/1.1", "", "partial", "a\rb"};
+  niodelimiter_t delimiter = {"\r\n", 2, 32};
+  niosocket_t pipes[2];
+  niochannel_t *reader;
+  nioslice_t record;
+  int i, got = 0, same = 1;
+
+  nio_pipe(pipes);
+  nio_socketnonblock(&pipes[0], 1);
+  nio_socketnonblock(&pipes[1], 1);
+
+  reader = nio_channel(&pipes[1], NULL);
+
+  /* records split across reads and a lone CR inside one */
+  for (i = 0; i < 4; ++i) {
+    nio_send(&pipes[0], chunks[i], (int)strlen(chunks[i]));
+    channel_read(reader);
+
+    while (1 == channel_readrecord(reader, &delimiter, &record)) {
+      if (got >= 4 || record.len != (int)strlen(expected[got]) ||
+          0 != memcmp(record.data, expected[got], record.len))
+        same = 0;
+      got += 1;
+    }
+
+    /* "par" and "tial\r" must not complete a record on their own */
+    if ((1 == i && 2 != got) || (2 == i && 3 != got))
+      same = 0;
+  }
+  check(same && 4 == got, "records split on the delimiter");
+
+  nio_send(&pipes[0], "0123456789012345678901234567890123456789", 40);
+  channel_read(reader);
+  check(-1 == channel_readrecord(reader, &delimiter, &record),
+        "records reject overlong input");
+
+  channel_destroy(reader);
+  nio_destroysocket(&pipes[0]);
+  nio_destroysocket(&pipes[1]);
+}
+
+/* sends until the socket buffer is full and the channel has to queue */
+static int channelfill(niochannel_t *channel) {
+  static char bulk[1 << 16];
+  int total = 0, i;
+
+  for (i = 0; i < 256 && 0 == channel_pending(channel); ++i) {
+    if (0 != channel_send(channel, bulk, sizeof(bulk)))
+      return -1;
+    total += sizeof(bulk);
+  }
+  return total;
+}
+
+/* reads what the channel flushes, the last len octets are kept in tail */
+static int channeldrain(niochannel_t *channel, niosocket_t *peer, char *tail,
+                        int len) {
+  static char buffer[1 << 16];
+  int total = 0, n, k;
+
+  for (k = 0; k < 100000; ++k) {
+    if (channel_flush(channel) < 0)
+      return -1;
+
+    n = nio_recv(peer, buffer, sizeof(buffer));
+
+    if (n >= len) {
+      memcpy(tail, buffer + n - len, len);
+    } else if (n > 0) {
+      memmove(tail, tail + n, len - n);
+      memcpy(tail + len - n, buffer, n);
+    } else if (0 == channel_pending(channel)) {
+      break;
+    }
+
+    if (n > 0)
+      total += n;
+  }
+  return total;
+}
+
+static void test_output(void) {
+  niosocket_t pipes[2][2];
+  niochannel_t *channels[2];
+  niobuffer_t *shared;
+  nioselector_t *sel;
+  niomonitor_t *monitor;
+  char tail[14];
+  int i, filled[2], pending;
+
+  for (i = 0; i < 2; ++i) {
+    nio_pipe(pipes[i]);
+    nio_socketnonblock(&pipes[i][0], 1);
+    nio_socketnonblock(&pipes[i][1], 1);
+
+    channels[i] = nio_channel(&pipes[i][0], NULL);
+    filled[i] = channelfill(channels[i]);
+  }
+
+  pending = channel_pending(channels[0]);
+  check(filled[0] > 0 && pending > 0 && pending < filled[0],
+        "channel_send writes what fits and queues the rest");
+
+  shared = nio_buffer("shared", 6);
+  check(0 == nio_fanout(channels, 2, shared),
+        "fanout queues one buffer on every channel");
+
+  channel_send(channels[0], "xy", 2);
+  check(6 == buffer_size(shared) &&
+            0 == memcmp(buffer_data(shared), "shared", 6) &&
+            pending + 8 == channel_pending(channels[0]),
+        "channel_send leaves a shared buffer alone");
+
+  /* after the shared buffer the small sends share one chunk */
+  for (i = 0; i < 8; ++i)
+    channel_send(channels[1], &"abcdefgh"[i], 1);
+
+  buffer_release(shared);
+
+  check(filled[0] + 8 == channeldrain(channels[0], &pipes[0][1], tail, 8) &&
+            0 == memcmp(tail, "sharedxy", 8),
+        "queued output drains in order");
+
+  check(filled[1] + 14 == channeldrain(channels[1], &pipes[1][1], tail, 14) &&
+            0 == memcmp(tail, "sharedabcdefgh", 14),
+        "channel_send coalesces small writes in order");
+
+  /* a failed flush must not leave the loop spinning on NIO_WRITE */
+  sel = nio_selector();
+  monitor = selector_register(sel, &pipes[0][0], NIO_READ, NULL);
+
+  channel_destroy(channels[0]);
+  channels[0] = nio_channel(&pipes[0][0], monitor);
+  channelfill(channels[0]);
+  check(NIO_WRITE == (monitor_getinterests(monitor) & NIO_WRITE),
+        "queued output asks for NIO_WRITE");
+
+  nio_destroysocket(&pipes[0][1]);
+  check(-1 == channel_flush(channels[0]) &&
+            0 == (monitor_getinterests(monitor) & NIO_WRITE),
+        "a failed flush drops NIO_WRITE");
+
+  channel_destroy(channels[0]);
+  channel_destroy(channels[1]);
+  selector_deregister(sel, &pipes[0][0]);
+  monitor_destroy(monitor);
+  selector_destroy(sel);
+
+  nio_destroysocket(&pipes[0][0]);
+  nio_destroysocket(&pipes[1][0]);
+  nio_destroysocket(&pipes[1][1]);
+}
+
+static const int attempts[2] = {0, 1};
+static unsigned long long timedout[2];
+
+#ifndef _WIN32
+static void test_pollbackend(void) {
+  nio_pollcreator creator = nio_pollbackend("poll");
+  niopoll_t *p;
+  niosocket_t pipes[3][2];
+  nioevent_t evt[4];
+  int tags[3] = {0, 1, 2};
+  int i, n;
+
+  check(!nio_pollbackend("io_uring") && !nio_pollbackend("nope") &&
+            !nio_pollbackend(NULL),
+        "pollbackend refuses unknown names");
+
+  if (!creator || !(p = creator())) {
+    check(0, "pollbackend builds poll");
+    return;
+  }
+  check(0 == strcmp("poll", p->method_backend(p)), "pollbackend builds poll");
+
+  for (i = 0; i < 3; ++i) {
+    nio_pipe(pipes[i]);
+    nio_send(&pipes[i][0], "x", 1);
+    p->method_register(p, pipes[i][1].sockfd, &tags[i]);
+  }
+  check(-1 == p->method_register(p, pipes[0][1].sockfd, &tags[0]),
+        "poll refuses a second registration");
+
+  /* registered without interest, nothing is reported */
+  n = p->method_wait(p, evt, 4, 0);
+  check(0 == n, "poll skips descriptors without interest");
+
+  for (i = 0; i < 3; ++i)
+    p->method_ioevent(p, pipes[i][1].sockfd, 1, 0, &tags[i]);
+
+  n = p->method_wait(p, evt, 4, 1000);
+  check(3 == n && evt[1].readable && &tags[1] == evt[1].userdata &&
+            pipes[1][1].sockfd == evt[1].fd,
+        "poll reports every ready descriptor");
+
+  p->method_ioevent(p, pipes[1][1].sockfd, 0, 0, &tags[1]);
+  n = p->method_wait(p, evt, 4, 0);
+  check(2 == n && &tags[1] != evt[0].userdata && &tags[1] != evt[1].userdata,
+        "poll drops a descriptor whose interest is removed");
+
+  p->method_ioevent(p, pipes[1][1].sockfd, 1, 0, &tags[1]);
+  n = p->method_wait(p, evt, 4, 0);
+  check(3 == n, "poll reports it again when interest returns");
+
+  /* the last entry moves into the middle hole */
+  check(0 == p->method_deregister(p, pipes[1][1].sockfd) &&
+            -1 == p->method_deregister(p, pipes[1][1].sockfd),
+        "poll deregisters once");
+
+  n = p->method_wait(p, evt, 4, 0);
+  check(2 == n && &tags[0] == evt[0].userdata && &tags[2] == evt[1].userdata &&
+            pipes[2][1].sockfd == evt[1].fd,
+        "poll keeps the moved entry after deregister");
+
+  check(-1 == p->method_ioevent(p, pipes[1][1].sockfd, 1, 0, &tags[1]),
+        "poll refuses interest on a deregistered descriptor");
+
+  p->method_deregister(p, pipes[0][1].sockfd);
+  p->method_deregister(p, pipes[2][1].sockfd);
+  n = p->method_wait(p, evt, 4, 20);
+  check(0 == n, "poll times out with nothing registered");
+
+  p->method_destroy(p);
+
+  for (i = 0; i < 3; ++i) {
+    nio_destroysocket(&pipes[i][0]);
+    nio_destroysocket(&pipes[i][1]);
+  }
+}
+#endif
+
+static void test_connected(void *ud, niosocket_t *s,
+                           const niosockaddr_t *addr) {
+  ((void)addr);
+
+  if (s)
+    nio_destroysocket(s);
+  else
+    timedout[*(const int *)ud] = nio_millisec();
+}
+
+static void test_timers(void) {
+  niosocket_t listener, filler;
+  niosockaddr_t addr;
+  nioselector_t *sel;
+  niomonitor_t *monitors[4];
+  unsigned long long start;
+  int k;
+
+  nio_createtcp4(&listener);
+  nio_hostaddr(&addr, "127.0.0.1", 0);
+  nio_bind(&listener, &addr);
+  nio_listen(&listener, 0);
+  nio_sockaddr(&listener, &addr);
+
+  /* a full accept queue drops SYNs, the timeouts are all that fire */
+  nio_createtcp4(&filler);
+  nio_socketnonblock(&filler, 1);
+  nio_connect(&filler, &addr);
+  nio_socketwritable(&filler, 1000);
+
+  sel = nio_selector();
+  start = nio_millisec();
+
+  selector_connect(sel, &addr, 1, 300, test_connected, (void *)&attempts[1]);
+  selector_connect(sel, &addr, 1, 100, test_connected, (void *)&attempts[0]);
+
+  for (k = 0; k < 10 && !timedout[1]; ++k)
+    selector_select(sel, monitors, 4, 10000);
+
+  check(timedout[0] >= start + 100 && timedout[1] >= start + 300 &&
+            timedout[0] < timedout[1] && timedout[1] < start + 900,
+        "timers fire in order and cut the wait short");
+
+  selector_destroy(sel);
+  nio_destroysocket(&filler);
+  nio_destroysocket(&listener);
+}
+
+/* loopback listener on an ephemeral port, addr receives the port */
+static int tcplisten(niosocket_t *listener, niosockaddr_t *addr, int backlog) {
+  nio_createtcp4(listener);
+  nio_hostaddr(addr, "127.0.0.1", 0);
+
+  if (0 != nio_bind(listener, addr) || 0 != nio_listen(listener, backlog) ||
+      0 != nio_sockaddr(listener, addr)) {
+    nio_destroysocket(listener);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* descriptors are allocated lowest first, a leak shifts this number */
+static int lowestfd(void) {
+  niosocket_t probe;
+  int fd;
+
+  nio_createtcp4(&probe);
+  fd = (int)probe.sockfd;
+  nio_destroysocket(&probe);
+
+  return fd;
+}
+
+static niosocket_t winner;
+static niosockaddr_t winneraddr;
+static int outcomes;
+
+static void test_winner(void *ud, niosocket_t *s, const niosockaddr_t *addr) {
+  ((void)ud);
+
+  outcomes += 1;
+
+  if (s) {
+    winner = *s;
+    winneraddr = *addr;
+  } else
+    nio_initsocket(&winner);
+}
+
+static int connectwait(nioselector_t *sel) {
+  niomonitor_t *monitors[4];
+  int k;
+
+  for (k = 0; k < 50 && 0 == outcomes; ++k)
+    selector_select(sel, monitors, 4, 100);
+
+  return outcomes;
+}
+
+static void test_connect(void) {
+  niosocket_t listener, refused, full, filler;
+  niosockaddr_t addrs[2], fulladdr;
+  nioselector_t *sel;
+  niomonitor_t *monitors[4];
+  nioipstr_t ipstr;
+  unsigned long long start;
+  int fd, fdbefore;
+
+  tcplisten(&listener, &addrs[1], 8);
+  tcplisten(&refused, &addrs[0], 1);
+  nio_destroysocket(&refused);
+
+  /* SYNs to a full accept queue are dropped, attempts there just hang */
+  tcplisten(&full, &fulladdr, 0);
+  nio_createtcp4(&filler);
+  nio_socketnonblock(&filler, 1);
+  nio_connect(&filler, &fulladdr);
+  nio_socketwritable(&filler, 1000);
+
+  fdbefore = lowestfd();
+  sel = nio_selector();
+  fd = lowestfd();
+
+  outcomes = 0;
+  selector_connect(sel, &addrs[1], 1, 1000, test_winner, NULL);
+  check(1 == connectwait(sel) && INVALID_SOCKET != winner.sockfd &&
+            nio_sockaddrequal(&winneraddr, &addrs[1]),
+        "connect delivers the winner");
+  nio_destroysocket(&winner);
+
+  outcomes = 0;
+  start = nio_millisec();
+  selector_connect(sel, addrs, 2, 1000, test_winner, NULL);
+  check(1 == connectwait(sel) && INVALID_SOCKET != winner.sockfd &&
+            nio_sockaddrequal(&winneraddr, &addrs[1]) &&
+            nio_millisec() - start < 200,
+        "connect falls back at once after a refusal");
+  nio_destroysocket(&winner);
+
+  outcomes = 0;
+  addrs[0] = fulladdr;
+  start = nio_millisec();
+  selector_connect(sel, addrs, 2, 2000, test_winner, NULL);
+  connectwait(sel);
+  selector_select(sel, monitors, 4, 0);
+  check(1 == outcomes && INVALID_SOCKET != winner.sockfd &&
+            nio_sockaddrequal(&winneraddr, &addrs[1]) &&
+            nio_millisec() - start >= 250,
+        "connect races a hanging attempt after the delay");
+  nio_destroysocket(&winner);
+  check(fd == lowestfd(), "connect closes the losing attempt");
+
+  outcomes = 0;
+  nio_ipstr(&ipstr, &addrs[1]);
+  selector_connecthost(sel, "localhost", (unsigned short)ipstr.port, 2000,
+                       test_winner, NULL);
+  check(1 == connectwait(sel) && INVALID_SOCKET != winner.sockfd,
+        "connecthost reaches localhost");
+  nio_destroysocket(&winner);
+
+  /* still racing when the selector goes away */
+  outcomes = 0;
+  selector_connect(sel, &fulladdr, 1, 0, test_winner, NULL);
+  selector_select(sel, monitors, 4, 0);
+  selector_destroy(sel);
+  check(1 == outcomes && INVALID_SOCKET == winner.sockfd &&
+            fdbefore == lowestfd(),
+        "selector_destroy fails connects in flight");
+
+  nio_destroysocket(&filler);
+  nio_destroysocket(&full);
+  nio_destroysocket(&listener);
+}
+
+static int corksent;
+
+static void test_corksend(void *ud, niosocket_t *s,
+                          const niosockaddr_t *addr) {
+  ((void)addr);
+
+  if (s)
+    nio_destroysocket(s);
+
+  corksent = (0 == channel_send((niochannel_t *)ud, "task", 4));
+}
+
+static void test_cork(void) {
+  niosocket_t pipes[2], listener;
+  niosockaddr_t addr;
+  nioselector_t *sel = nio_selector();
+  niomonitor_t *monitors[4], *monitor;
+  niochannel_t *channel;
+  char buffer[16];
+  int k, n;
+
+  nio_pipe(pipes);
+  nio_socketnonblock(&pipes[0], 1);
+  nio_socketnonblock(&pipes[1], 1);
+
+  channel = nio_channel(&pipes[0], NULL);
+  check(-1 == channel_cork(channel, 1), "cork needs a monitor");
+  channel_destroy(channel);
+
+  monitor = selector_register(sel, &pipes[0], NIO_READ, NULL);
+  channel = nio_channel(&pipes[0], monitor);
+
+  channel_cork(channel, 1);
+  channel_send(channel, "ab", 2);
+  channel_send(channel, "cd", 2);
+  check(channel_corked(channel) && 4 == channel_pending(channel) &&
+            nio_recv(&pipes[1], buffer, sizeof(buffer)) < 0,
+        "corked output waits");
+
+  selector_select(sel, monitors, 4, 0);
+  n = nio_recv(&pipes[1], buffer, sizeof(buffer));
+  check(4 == n && 0 == memcmp(buffer, "abcd", 4) && channel_corked(channel),
+        "selector_select flushes corked output");
+
+  /* the connect callback runs as a task inside selector_select */
+  tcplisten(&listener, &addr, 8);
+  selector_connect(sel, &addr, 1, 1000, test_corksend, channel);
+
+  for (k = 0; k < 50 && !corksent; ++k)
+    selector_select(sel, monitors, 4, 100);
+
+  n = nio_recv(&pipes[1], buffer, sizeof(buffer));
+  check(corksent && 4 == n && 0 == memcmp(buffer, "task", 4),
+        "output corked by tasks leaves before selector_select returns");
+  nio_destroysocket(&listener);
+
+  channel_send(channel, "ef", 2);
+  check(0 == channel_cork(channel, 0) && !channel_corked(channel) &&
+            2 == nio_recv(&pipes[1], buffer, sizeof(buffer)),
+        "uncork flushes");
+
+  channel_cork(channel, 1);
+  channel_send(channel, "gh", 2);
+  selector_destroy(sel);
+  check(!channel_corked(channel) && !channel_monitor(channel) &&
+            2 == channel_pending(channel),
+        "selector_destroy uncorks and detaches");
+
+  check(0 == channel_flush(channel) &&
+            2 == nio_recv(&pipes[1], buffer, sizeof(buffer)),
+        "detached output still flushes");
+
+  channel_destroy(channel);
+  nio_destroysocket(&pipes[0]);
+  nio_destroysocket(&pipes[1]);
+}
+
+/* blocking connection to the listener, the server end is accepted */
+static int tcpconnect(niosocket_t *listener, const niosockaddr_t *addr,
+                      niosocket_t *client, niosocket_t *server) {
+  nio_createtcp4(client);
+
+  if (0 != nio_connect(client, addr))
+    return -1;
+
+  return nio_accept(listener, server, NULL);
+}
+
+static void test_connpool(void) {
+  niosocket_t listener, client, servers[4], got;
+  niosockaddr_t addr;
+  nioselector_t *sel;
+  nioconnpool_t *pool;
+  niomonitor_t *monitors[4];
+  unsigned long long start;
+  int fd, fdbefore = lowestfd(), k;
+
+  sel = nio_selector();
+  pool = nio_connpool(sel, 8, 1, 100);
+  tcplisten(&listener, &addr, 8);
+
+  tcpconnect(&listener, &addr, &client, &servers[0]);
+  fd = (int)client.sockfd;
+  connpool_release(pool, &addr, &client);
+  check(1 == connpool_idle(pool) && 1 == connpool_acquire(pool, &addr, &got) &&
+            fd == (int)got.sockfd && 0 == connpool_idle(pool) &&
+            0 == connpool_acquire(pool, &addr, &client),
+        "connpool hands back an idle connection once");
+
+  /* the host entry went with its last connection, it comes back */
+  connpool_release(pool, &addr, &got);
+  tcpconnect(&listener, &addr, &client, &servers[1]);
+  fd = (int)client.sockfd;
+  connpool_release(pool, &addr, &client);
+  check(1 == connpool_idle(pool) && 1 == connpool_acquire(pool, &addr, &got) &&
+            fd == (int)got.sockfd,
+        "connpool keeps the newest per host");
+
+  /* a FIN that arrived while idle, no selector_select in between */
+  connpool_release(pool, &addr, &got);
+  nio_destroysocket(&servers[1]);
+  check(0 == connpool_acquire(pool, &addr, &got) && 0 == connpool_idle(pool),
+        "connpool drops a peer-closed connection on acquire");
+
+  tcpconnect(&listener, &addr, &client, &servers[2]);
+  connpool_release(pool, &addr, &client);
+  nio_destroysocket(&servers[2]);
+
+  for (k = 0; k < 10 && connpool_idle(pool); ++k)
+    selector_select(sel, monitors, 4, 50);
+  check(0 == connpool_idle(pool),
+        "connpool drops a peer-closed idle connection");
+
+  tcpconnect(&listener, &addr, &client, &servers[3]);
+  start = nio_millisec();
+  connpool_release(pool, &addr, &client);
+
+  for (k = 0; k < 50 && connpool_idle(pool); ++k)
+    selector_select(sel, monitors, 4, 1000);
+  check(0 == connpool_idle(pool) && nio_millisec() - start >= 100 &&
+            nio_millisec() - start < 1000,
+        "connpool expires idle connections");
+
+  connpool_destroy(pool);
+  selector_destroy(sel);
+
+  nio_destroysocket(&servers[0]);
+  nio_destroysocket(&servers[3]);
+  nio_destroysocket(&listener);
+  check(fdbefore == lowestfd(), "connpool closes what it drops");
+}
+
+static const int lookups[4] = {0, 1, 2, 3};
+static int lookupcalls[4], lookupcounts[4], lookupports[4], lookuprounds[4];
+static int lookupround, lookupthread[4];
+#ifndef _WIN32
+static pthread_t selectorthread;
+#endif
+
+static void test_resolved(void *ud, const niosockaddr_t *addrs, int count) {
+  int i = *(const int *)ud;
+  nioipstr_t ipstr;
+
+  lookupcalls[i] += 1;
+  lookupcounts[i] = count;
+  lookuprounds[i] = lookupround;
+  lookupports[i] = 0;
+
+  if (count > 0 && 0 == nio_ipstr(&ipstr, &addrs[0]))
+    lookupports[i] = ipstr.port;
+#ifndef _WIN32
+  lookupthread[i] = pthread_equal(selectorthread, pthread_self());
+#else
+  lookupthread[i] = 1;
+#endif
+}
+
+static void test_resolve(void) {
+  nioselector_t *sel = nio_selector();
+  niomonitor_t *monitors[4];
+
+#ifndef _WIN32
+  selectorthread = pthread_self();
+#endif
+
+  /* the second caller joins the query the first one started */
+  selector_resolve(sel, "localhost", 1001, AF_INET, test_resolved,
+                   (void *)&lookups[0]);
+  selector_resolve(sel, "localhost", 1002, AF_INET, test_resolved,
+                   (void *)&lookups[1]);
+
+  for (lookupround = 1; lookupround < 50; ++lookupround) {
+    if (lookupcalls[0] && lookupcalls[1])
+      break;
+    selector_select(sel, monitors, 4, 100);
+  }
+
+  check(1 == lookupcalls[0] && 1 == lookupcalls[1] && lookupcounts[0] > 0 &&
+            lookupcounts[1] > 0 && lookuprounds[0] == lookuprounds[1] &&
+            1001 == lookupports[0] && 1002 == lookupports[1],
+        "two callers share one lookup");
+  check(lookupthread[0] && lookupthread[1],
+        "resolve callbacks run on the selector thread");
+
+  /* a queued cache hit, a lookup in flight and a connect waiting on both */
+  selector_resolve(sel, "localhost", 1003, AF_INET, test_resolved,
+                   (void *)&lookups[2]);
+  selector_resolve(sel, "localhost", 1004, AF_INET6, test_resolved,
+                   (void *)&lookups[3]);
+
+  outcomes = 0;
+  selector_connecthost(sel, "localhost", 9, 1000, test_winner, NULL);
+
+  selector_destroy(sel);
+
+  check(1 == lookupcalls[2] && 0 == lookupcounts[2] && 1 == lookupcalls[3] &&
+            0 == lookupcounts[3],
+        "selector_destroy fails pending lookups");
+  check(1 == outcomes && INVALID_SOCKET == winner.sockfd,
+        "selector_destroy fails a connect still resolving");
+}
+
+static int accepts;
+
+/* ud is the listener to destroy from inside the callback, or NULL */
+static void test_accepted(void *ud, niosocket_t *s,
+                          const niosockaddr_t *addr) {
+  niolistener_t **self = (niolistener_t **)ud;
+
+  ((void)addr);
+
+  accepts += 1;
+  nio_destroysocket(s);
+
+  if (self && *self) {
+    listener_destroy(*self);
+    *self = NULL;
+  }
+}
+
+static void test_listener(void) {
+  niosocket_t server, clients[5];
+  niosockaddr_t addr;
+  nioselector_t *sel;
+  niomonitor_t *monitors[4];
+  niolistener_t *listener, *self;
+#ifndef _WIN32
+  struct rlimit limit, lowered;
+  char octet;
+  int paused, shed;
+#endif
+  int i, k, rounds[3], fdbefore = lowestfd();
+
+  sel = nio_selector();
+  tcplisten(&server, &addr, 16);
+
+  listener = nio_listener(sel, &server, 2, test_accepted, NULL);
+
+  for (i = 0; i < 5; ++i) {
+    nio_createtcp4(&clients[i]);
+    nio_connect(&clients[i], &addr);
+  }
+
+  for (k = 0; k < 3; ++k) {
+    accepts = 0;
+    selector_select(sel, monitors, 4, 1000);
+    rounds[k] = accepts;
+  }
+  check(2 == rounds[0] && 2 == rounds[1] && 1 == rounds[2],
+        "listener caps accepts per selector_select");
+
+  listener_destroy(listener);
+
+  /* three accepted in one batch, the first callback ends it */
+  self = nio_listener(sel, &server, 0, test_accepted, &self);
+
+  for (i = 0; i < 3; ++i) {
+    nio_destroysocket(&clients[i]);
+    nio_createtcp4(&clients[i]);
+    nio_connect(&clients[i], &addr);
+  }
+
+  accepts = 0;
+  selector_select(sel, monitors, 4, 1000);
+  selector_select(sel, monitors, 4, 50);
+  check(!self && 1 == accepts, "a callback may destroy its own listener");
+
+  for (i = 0; i < 5; ++i)
+    nio_destroysocket(&clients[i]);
+
+#ifndef _WIN32
+  listener = nio_listener(sel, &server, 0, test_accepted, NULL);
+
+  nio_createtcp4(&clients[0]);
+  nio_connect(&clients[0], &addr);
+
+  /* every descriptor below the limit is taken, accept fails with EMFILE */
+  getrlimit(RLIMIT_NOFILE, &limit);
+  lowered = limit;
+  lowered.rlim_cur = lowestfd();
+  setrlimit(RLIMIT_NOFILE, &lowered);
+
+  accepts = 0;
+  selector_select(sel, monitors, 4, 1000);
+  paused = listener_paused(listener);
+
+  setrlimit(RLIMIT_NOFILE, &limit);
+
+  shed = 1 == nio_socketreadable(&clients[0], 1000) &&
+         0 == nio_recv(&clients[0], &octet, 1);
+  check(0 == accepts && paused && shed,
+        "EMFILE closes the pending peer through the reserve");
+
+  nio_createtcp4(&clients[1]);
+  nio_connect(&clients[1], &addr);
+
+  for (k = 0; k < 50 && !accepts; ++k)
+    selector_select(sel, monitors, 4, 100);
+  check(1 == accepts && !listener_paused(listener),
+        "listener resumes after the backoff");
+
+  listener_destroy(listener);
+  nio_destroysocket(&clients[0]);
+  nio_destroysocket(&clients[1]);
+#endif
+
+  selector_destroy(sel);
+  nio_destroysocket(&server);
+  check(fdbefore == lowestfd(), "listener closes what it drops");
+}
+
+static void test_acceptmany(void) {
+  niosocket_t server, clients[3], accepted[8];
+  niosockaddr_t addr, local, addrs[8];
+  char octet;
+  int i, n, again, same = 1, flagged = 1;
+
+  tcplisten(&server, &addr, 8);
+  nio_socketnonblock(&server, 1);
+
+  for (i = 0; i < 3; ++i) {
+    nio_createtcp4(&clients[i]);
+    nio_connect(&clients[i], &addr);
+  }
+
+  n = nio_acceptmany(&server, accepted, addrs, 2,
+                     NIO_SOCKNONBLOCK | NIO_SOCKCLOEXEC);
+  again = nio_acceptmany(&server, accepted + n, addrs + n, 8 - n,
+                         NIO_SOCKNONBLOCK | NIO_SOCKCLOEXEC);
+  check(2 == n && 1 == again, "acceptmany stops at count");
+  check(0 == nio_acceptmany(&server, accepted, addrs, 8, 0),
+        "acceptmany returns 0 once drained");
+
+  for (i = 0; i < 3; ++i) {
+    nio_sockaddr(&clients[i], &local);
+    if (!nio_sockaddrequal(&local, &addrs[i]))
+      same = 0;
+
+    /* nothing was sent, a non-blocking receive returns at once */
+    if (nio_recv(&accepted[i], &octet, 1) >= 0)
+      flagged = 0;
+#ifndef _WIN32
+    if (0 == (fcntl(accepted[i].sockfd, F_GETFD) & FD_CLOEXEC))
+      flagged = 0;
+#endif
+  }
+  check(same, "acceptmany fills the peer addresses in order");
+  check(flagged, "acceptmany applies the socket flags");
+
+  for (i = 0; i < 3; ++i) {
+    nio_destroysocket(&clients[i]);
+    nio_destroysocket(&accepted[i]);
+  }
+  nio_destroysocket(&server);
+
+  nio_createtcp4(&server);
+  check(-1 == nio_acceptmany(&server, accepted, NULL, 8, 0),
+        "acceptmany fails on a socket that is not listening");
+  nio_destroysocket(&server);
+}
+
+static void test_fastopen(void) {
+  niosocket_t server, client, session;
+  niosockaddr_t addr;
+  char buffer[16];
+  int sent, n = -1;
+
+  tcplisten(&server, &addr, 8);
+  check(0 == nio_tcpfastopen(&server, 16), "tcpfastopen on a listener");
+  check(0 == nio_deferaccept(&server, 1), "deferaccept on a listener");
+
+  /* without a cookie the payload follows the handshake, but it arrives */
+  nio_createtcp4(&client);
+  sent = nio_connectfastopen(&client, &addr, "hello", 5);
+
+  if (sent >= 0 && sent < 5 && 0 == nio_socketwritable(&client, 1000))
+    sent = -1;
+  if (sent >= 0 && sent < 5)
+    sent += nio_sendall(&client, "hello" + sent, 5 - sent);
+
+  if (5 == sent && 0 == nio_accept(&server, &session, NULL)) {
+    n = nio_recvall(&session, buffer, 5);
+    nio_destroysocket(&session);
+  }
+
+  check(5 == n && 0 == memcmp(buffer, "hello", 5),
+        "connectfastopen delivers its payload");
+
+  nio_destroysocket(&client);
+  nio_destroysocket(&server);
+}
+
+static void test_reuseportgroup(void) {
+  niosocket_t listeners[3], client, session;
+  niosockaddr_t addr;
+  int i, bound = 1, landed = 0;
+
+  nio_hostaddr(&addr, "127.0.0.1", 0);
+
+  /* the first bind picks the port, the rest join its group */
+  for (i = 0; i < 3; ++i) {
+    nio_createtcp4(&listeners[i]);
+    nio_reuseport(&listeners[i], 1);
+
+    if (0 != nio_bind(&listeners[i], &addr) ||
+        0 != nio_listen(&listeners[i], 8) ||
+        0 != nio_sockaddr(&listeners[i], &addr))
+      bound = 0;
+
+    nio_socketnonblock(&listeners[i], 1);
+  }
+
+  check(-1 == nio_reuseportgroup(listeners, 0, NIO_REUSEPORT_HASH) &&
+            -1 == nio_reuseportgroup(listeners, 3, NIO_REUSEPORT_HASH),
+        "reuseportgroup rejects empty and non power of two groups");
+
+#if defined(__linux__)
+  check(bound && 0 == nio_reuseportgroup(listeners, 2, NIO_REUSEPORT_CPU) &&
+            0 == nio_reuseportgroup(listeners, 2, NIO_REUSEPORT_HASH),
+        "reuseportgroup attaches to a two listener group");
+
+  nio_destroysocket(&listeners[2]);
+
+  nio_createtcp4(&client);
+  if (0 == nio_connect(&client, &addr)) {
+    for (i = 0; i < 2; ++i) {
+      nio_socketreadable(&listeners[i], 100);
+
+      if (0 == nio_accept(&listeners[i], &session, NULL)) {
+        landed += 1;
+        nio_destroysocket(&session);
+      }
+    }
+  }
+  check(1 == landed, "a steered connection lands on one listener");
+  nio_destroysocket(&client);
+#else
+  (void)bound;
+  (void)landed;
+  (void)client;
+  (void)session;
+#endif
+
+  for (i = 0; i < 3; ++i)
+    nio_destroysocket(&listeners[i]);
+}
+
+static void test_busypoll(void) {
+  nioselector_t *sel = nio_selector();
+  niomonitor_t *monitors[4], *monitor;
+  niosocket_t pipes[2];
+  unsigned long long start, elapsed[3];
+  int n[3];
+
+  /* the spin is longer than the timeout, the timeout wins */
+  selector_setbusypoll(sel, 200000);
+  start = nio_millisec();
+  n[0] = selector_select(sel, monitors, 4, 50);
+  elapsed[0] = nio_millisec() - start;
+
+  /* the spin is shorter, the rest of the timeout is slept */
+  selector_setbusypoll(sel, 20000);
+  start = nio_millisec();
+  n[1] = selector_select(sel, monitors, 4, 100);
+  elapsed[1] = nio_millisec() - start;
+
+  check(0 == n[0] && elapsed[0] >= 50 && elapsed[0] < 150 && 0 == n[1] &&
+            elapsed[1] >= 100 && elapsed[1] < 500,
+        "busypoll honours the caller's timeout");
+
+  nio_pipe(pipes);
+  monitor = selector_register(sel, &pipes[1], NIO_READ, NULL);
+  nio_send(&pipes[0], "x", 1);
+
+  start = nio_millisec();
+  n[2] = selector_select(sel, monitors, 4, 1000);
+  elapsed[2] = nio_millisec() - start;
+  check(1 == n[2] && elapsed[2] < 100, "busypoll returns events at once");
+
+  monitor_destroy(monitor);
+  selector_destroy(sel);
+  nio_destroysocket(&pipes[0]);
+  nio_destroysocket(&pipes[1]);
+}
+
+#ifndef _WIN32
+static int sigblocked(int signo) {
+  sigset_t current;
+
+  pthread_sigmask(SIG_BLOCK, NULL, &current);
+  return sigismember(&current, signo);
+}
+
+static void test_signals(void) {
+  nioselector_t *sel = nio_selector();
+  niomonitor_t *monitors[4], *watcher;
+  sigset_t mask;
+  int n, again;
+
+  /* the application already blocks SIGUSR1 for its own reasons */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  watcher = selector_watchsignal(sel, SIGUSR2, NULL);
+  check(watcher && !selector_watchsignal(sel, SIGUSR2, NULL),
+        "signals have one watcher each");
+
+  raise(SIGUSR2);
+  raise(SIGUSR2);
+  raise(SIGUSR2);
+
+  n = selector_select(sel, monitors, 4, 1000);
+  check(1 == n && watcher == monitors[0] && monitor_readable(watcher),
+        "signals are delivered to the selector");
+
+  again = selector_select(sel, monitors, 4, 50);
+  check(0 == again, "signals coalesce into one readiness");
+
+  selector_unwatchsignal(sel, watcher);
+  check(!sigblocked(SIGUSR2), "unwatch unblocks what it blocked");
+
+  /* left watching, the selector must give the signal back */
+  selector_watchsignal(sel, SIGUSR1, NULL);
+  selector_destroy(sel);
+
+  sel = nio_selector();
+  watcher = selector_watchsignal(sel, SIGUSR1, NULL);
+  check(watcher && sigblocked(SIGUSR1),
+        "selector_destroy unwatches, the prior mask stays");
+
+  selector_unwatchsignal(sel, watcher);
+  selector_destroy(sel);
+
+  check(sigblocked(SIGUSR1), "unwatch keeps an application block");
+  pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+}
+#endif
+
+#ifndef _WIN32
+static int shmlen(int i) { return 1 + (i * 181) % 1200; }
+
+/* each message is filled with its sequence number */
+static int shmexpect(const char *buf, int n, int i) {
+  return n == shmlen(i) && (char)i == buf[0] && (char)i == buf[n - 1];
+}
+
+static void test_shmchannel(void) {
+  static char msg[4096], buf[4096];
+  nioshmchannel_t *shm = nio_shmchannel(4096), *peer;
+  niosocket_t *io;
+  int fds[NIO_SHMFDS];
+  int i, n, k, rang, silent, status, got = 0, full = 0, same = 1;
+  pid_t pid;
+
+  if (!shm) {
+    check(0, "shmchannel creates a ring");
+    return;
+  }
+
+  check(-1 == shmchannel_write(shm, msg, 0) &&
+            -1 == shmchannel_write(shm, msg, sizeof(msg)),
+        "shmchannel refuses empty and oversized messages");
+
+  /* fill, drain, and so on many times around the ring */
+  for (i = 0; i < 400;) {
+    memset(msg, i, shmlen(i));
+
+    if (shmchannel_write(shm, msg, shmlen(i)) > 0) {
+      i += 1;
+      continue;
+    }
+
+    full += 1;
+
+    while ((n = shmchannel_read(shm, buf, sizeof(buf))) > 0)
+      if (!shmexpect(buf, n, got++))
+        same = 0;
+  }
+
+  while ((n = shmchannel_read(shm, buf, sizeof(buf))) > 0)
+    if (!shmexpect(buf, n, got++))
+      same = 0;
+
+  check(same && 400 == got && full > 10,
+        "shmchannel wraps variable length messages");
+
+  /* header and payload take the whole ring */
+  check(4092 == shmchannel_write(shm, msg, 4092) &&
+            0 == shmchannel_write(shm, msg, 1) &&
+            4092 == shmchannel_peeksize(shm),
+        "shmchannel_write returns 0 on a full ring");
+
+  shmchannel_read(shm, buf, sizeof(buf));
+  check(1 == shmchannel_write(shm, msg, 1) &&
+            1 == shmchannel_read(shm, buf, sizeof(buf)),
+        "a drained ring takes writes again");
+
+  io = shmchannel_io(shm);
+  shmchannel_fds(shm, fds);
+
+  /* the empty read sets waiting, the first write rings */
+  shmchannel_read(shm, buf, sizeof(buf));
+  shmchannel_write(shm, "a", 1);
+  rang = nio_socketreadable(io, 0);
+
+  while (read(fds[1], buf, sizeof(buf)) > 0)
+    ;
+
+  shmchannel_write(shm, "b", 1);
+  silent = !nio_socketreadable(io, 0);
+  check(1 == rang && silent, "doorbell rings only for a waiting consumer");
+
+  shmchannel_read(shm, buf, sizeof(buf));
+  shmchannel_read(shm, buf, sizeof(buf));
+  shmchannel_read(shm, buf, sizeof(buf));
+  shmchannel_write(shm, "c", 1);
+  check(1 == nio_socketreadable(io, 0) &&
+            1 == shmchannel_read(shm, buf, sizeof(buf)) && 'c' == buf[0],
+        "doorbell rings again once the consumer waits");
+
+  pid = fork();
+
+  if (0 == pid) {
+    shmchannel_fds(shm, fds);
+    peer = nio_shmchannelattach(fds);
+
+    for (i = 0; peer && i < 400;) {
+      memset(msg, i, shmlen(i));
+
+      if (shmchannel_write(peer, msg, shmlen(i)) > 0)
+        i += 1;
+      else
+        usleep(1000);
+    }
+    _exit(peer ? 0 : 1);
+  }
+
+  for (got = 0, same = 1, k = 0; pid > 0 && got < 400 && k < 1000; ++k) {
+    n = shmchannel_read(shm, buf, sizeof(buf));
+
+    if (n < 0)
+      break;
+
+    if (0 == n)
+      nio_socketreadable(io, 100);
+    else if (!shmexpect(buf, n, got++))
+      same = 0;
+  }
+
+  status = -1;
+  if (pid > 0)
+    waitpid(pid, &status, 0);
+
+  check(same && 400 == got && WIFEXITED(status) && 0 == WEXITSTATUS(status),
+        "a forked producer attaches through shmchannel_fds");
+
+  shmchannel_destroy(shm);
+}
+#endif
+
+#ifndef _WIN32
+static void test_spawn(void) {
+  static char *const argv[] = {"sh", "-c", "echo x; exit 3", NULL};
+  nioprocess_t proc;
+  char buffer[16];
+  int n, status = -1, reaped = -1, k;
+
+  if (0 != nio_spawn(&proc, "/bin/sh", argv, NULL)) {
+    check(0, "spawn runs /bin/sh");
+    return;
+  }
+
+  nio_socketreadable(&proc.out, 2000);
+  n = nio_recv(&proc.out, buffer, sizeof(buffer));
+  check(2 == n && 0 == memcmp(buffer, "x\n", 2),
+        "spawn reads the child stdout");
+
+  if (INVALID_SOCKET != proc.exit.sockfd) {
+    check(1 == nio_socketreadable(&proc.exit, 2000),
+          "the pidfd turns readable on exit");
+    reaped = nio_reap(&proc, &status, 0);
+  } else {
+    for (k = 0; k < 200 && 0 == (reaped = nio_reap(&proc, &status, 0)); ++k)
+      nio_socketreadable(&proc.out, 10);
+  }
+
+  check(1 == reaped && 3 == status, "nio_reap returns the exit status");
+  nio_destroyprocess(&proc);
+
+  errno = 0;
+  check(-1 == nio_spawn(&proc, "/nonexistent/nio4c", argv, NULL) &&
+            ENOENT == errno && -1 == proc.pid,
+        "spawn failures set errno");
+  nio_destroyprocess(&proc);
+}
+#endif
+
+#ifndef _WIN32
+static void test_unix(void) {
+  niosocket_t server, client, session;
+  niosockaddr_t addr, bound;
+  char name[64], path[108], buffer[16];
+  int n[4] = {-1, -1, -1, -1};
+
+  check(0 == nio_unixaddr(&addr, "/tmp/nio4c.sock") &&
+            15 == nio_unixpath(&addr, path, sizeof(path)) &&
+            0 == strcmp(path, "/tmp/nio4c.sock"),
+        "unixaddr and unixpath round trip a path");
+
+#if defined(__linux__)
+  sprintf(name, "@nio4c-test-%d", (int)getpid());
+
+  nio_unixaddr(&addr, name);
+  nio_createunix(&server, SOCK_SEQPACKET);
+
+  /* read back from the kernel, not from our own buffer */
+  if (0 == nio_bind(&server, &addr) && 0 == nio_listen(&server, 1) &&
+      0 == nio_sockaddr(&server, &bound))
+    n[0] = nio_unixpath(&bound, path, sizeof(path));
+
+  check((int)strlen(name) == n[0] && 0 == strcmp(path, name),
+        "abstract names round trip through the kernel");
+
+  nio_createunix(&client, SOCK_SEQPACKET);
+  n[0] = -1;
+
+  if (0 == nio_connect(&client, &addr) &&
+      0 == nio_accept(&server, &session, NULL)) {
+    nio_send(&client, "one", 3);
+    nio_send(&client, "three", 5);
+
+    n[0] = nio_recv(&session, buffer, sizeof(buffer));
+    n[1] = nio_recv(&session, buffer + 3, sizeof(buffer) - 3);
+
+    /* a short buffer takes one message and drops its tail */
+    nio_send(&client, "truncated", 9);
+    nio_send(&client, "!", 1);
+    n[2] = nio_recv(&session, buffer + 8, 2);
+    n[3] = nio_recv(&session, buffer + 10, 6);
+    nio_destroysocket(&session);
+  }
+
+  check(3 == n[0] && 5 == n[1] && 2 == n[2] && 1 == n[3] &&
+            0 == memcmp(buffer, "onethreetr!", 11),
+        "seqpacket keeps message boundaries");
+
+  nio_destroysocket(&client);
+  nio_destroysocket(&server);
+#else
+  (void)name;
+  (void)bound;
+  (void)buffer;
+  (void)n;
+#endif
+}
+#endif
+
+#ifndef _WIN32
+static void test_passfds(void) {
+  niosocket_t pair[2], inner[2], passed;
+  int fds[3], count, fdbefore, n;
+  char buffer[8];
+
+  nio_pipe(pair);
+  nio_pipe(inner);
+
+  /* the received copy reaches the same socket as the one sent */
+  count = 1;
+  nio_sendfds(&pair[0], &inner[0].sockfd, 1, "fd", 2);
+  n = nio_recvfds(&pair[1], fds, &count, buffer, sizeof(buffer));
+
+  passed.sockfd = 1 == count ? fds[0] : INVALID_SOCKET;
+  nio_send(&inner[1], "ping", 4);
+
+  check(2 == n && 1 == count && fds[0] != inner[0].sockfd &&
+            4 == nio_recv(&passed, buffer + 2, 4) &&
+            0 == memcmp(buffer, "fdping", 6) &&
+            0 != (fcntl(fds[0], F_GETFD) & FD_CLOEXEC),
+        "a passed fd works in the receiver");
+  nio_destroysocket(&passed);
+
+  /* three sent, room for two, none may stay open */
+  fds[0] = fds[1] = fds[2] = inner[0].sockfd;
+  nio_sendfds(&pair[0], fds, 3, NULL, 0);
+
+  fdbefore = lowestfd();
+  count = 2;
+  n = nio_recvfds(&pair[1], fds, &count, buffer, sizeof(buffer));
+  check(-1 == n && 0 == count && fdbefore == lowestfd(),
+        "a truncated set closes every received fd");
+
+  nio_destroysocket(&inner[0]);
+  nio_destroysocket(&inner[1]);
+  nio_destroysocket(&pair[0]);
+  nio_destroysocket(&pair[1]);
+}
+#endif
+
+/* blocking loopback connection, the listener is closed again */
+static int tcppair(niosocket_t *client, niosocket_t *server) {
+  niosocket_t listener;
+  niosockaddr_t addr;
+  int retval = -1;
+
+  nio_createtcp4(&listener);
+  nio_hostaddr(&addr, "127.0.0.1", 0);
+
+  if (0 == nio_bind(&listener, &addr) && 0 == nio_listen(&listener, 1) &&
+      0 == nio_sockaddr(&listener, &addr)) {
+    nio_createtcp4(client);
+
+    if (0 == nio_connect(client, &addr))
+      retval = nio_accept(&listener, server, NULL);
+  }
+
+  nio_destroysocket(&listener);
+  return retval;
+}
+
+static void test_deadlines(void) {
+  static char bulk[1 << 23];
+  niosocket_t client, server;
+  unsigned long long start;
+  char buffer[16];
+  int retval;
+
+  if (0 != tcppair(&client, &server)) {
+    check(0, "deadlines on a blocking socket");
+    return;
+  }
+
+  start = nio_millisec();
+  retval = nio_recvalldeadline(&server, buffer, sizeof(buffer), start + 100);
+  check(0 == retval && nio_millisec() - start >= 100 &&
+            nio_millisec() - start < 1000,
+        "recvalldeadline gives up on an idle socket");
+
+  nio_send(&client, "hello", 5);
+  start = nio_millisec();
+  retval = nio_recvalldeadline(&server, buffer, sizeof(buffer), start + 100);
+  check(5 == retval && nio_millisec() - start < 1000,
+        "recvalldeadline returns a short read");
+
+  /* nobody reads, the socket buffers fill up long before 8 MiB */
+  start = nio_millisec();
+  retval = nio_sendalldeadline(&client, bulk, sizeof(bulk), start + 100);
+  check(retval > 0 && retval < (int)sizeof(bulk) &&
+            nio_millisec() - start < 1000,
+        "sendalldeadline returns what fit");
+
+  nio_destroysocket(&client);
+  nio_destroysocket(&server);
+}
+
+static void test_stats(void) {
+  nioselectorstats_t stats;
+  nioselector_t *sel = nio_selector();
+  niomonitor_t *monitors[4], *monitor;
+  niosocket_t pipes[2];
+  unsigned long long start, buckets = 0;
+  int i, n;
+
+  /* five calls before the loop drains them are one octet on the pipe */
+  for (i = 0; i < 5; ++i)
+    selector_wakeup(sel);
+
+  selector_stats(sel, &stats);
+  check(1 == stats.wakeups && 4 == stats.coalesced,
+        "wakeups coalesce until drained");
+
+  start = nio_millisec();
+  n = selector_select(sel, monitors, 4, 10000);
+  selector_wakeup(sel);
+  selector_stats(sel, &stats);
+  check(0 == n && nio_millisec() - start < 1000 && 2 == stats.wakeups &&
+            1 == stats.waits,
+        "wakeup ends the wait and rearms");
+  selector_select(sel, monitors, 4, 0);
+
+  nio_pipe(pipes);
+  nio_socketnonblock(&pipes[0], 1);
+  nio_socketnonblock(&pipes[1], 1);
+
+  monitor = selector_register(sel, &pipes[1], NIO_READ, NULL);
+  monitor_addinterest(monitor, NIO_WRITE);
+  nio_send(&pipes[0], "x", 1);
+  n = selector_select(sel, monitors, 4, 1000);
+
+  selector_stats(sel, &stats);
+  for (i = 0; i < NIO_STATSBUCKETS; ++i)
+    buckets += stats.eventsperwait[i];
+
+  check(1 == n && 1 == stats.registered && 2 == stats.interestchanges &&
+            3 == stats.waits && buckets == stats.waits && stats.events >= 1,
+        "stats count waits, events and interest changes");
+
+  selector_deregister(sel, &pipes[1]);
+  monitor_destroy(monitor);
+  selector_destroy(sel);
+  nio_destroysocket(&pipes[0]);
+  nio_destroysocket(&pipes[1]);
+}
+
+static unsigned long long stalled;
+
+static void test_stalled(void *ud, unsigned long long usec) {
+  ((void)ud);
+  stalled = usec;
+}
+
+static void test_latency(void) {
+  static nioselectorlatency_t latency;
+  unsigned long long upper, prev = 0;
+  nioselector_t *sel;
+  niomonitor_t *monitors[4];
+  int i, linear = 1;
+
+  check(0 == nio_latencypercentile(&latency, 50.0),
+        "latency percentile of nothing");
+
+  /* a lone sample reports the upper bound of its bucket, capped by max */
+  latency.count = 1;
+  latency.max = ~0ULL;
+
+  for (i = 0; i < NIO_LATENCYBUCKETS; ++i) {
+    memset(latency.buckets, 0, sizeof(latency.buckets));
+    latency.buckets[i] = 1;
+    upper = nio_latencypercentile(&latency, 50.0);
+
+    /* buckets are contiguous and at most 25% of their lower bound wide */
+    if (i < 4 ? upper != (unsigned long long)i
+              : upper <= prev || (upper - prev) * 4 > prev + 1)
+      linear = 0;
+
+    prev = upper;
+  }
+  check(linear, "latency buckets are log-linear");
+
+  memset(&latency, 0, sizeof(latency));
+  latency.count = 100;
+  latency.max = 1000;
+  latency.buckets[1] = 90;
+  latency.buckets[NIO_LATENCYBUCKETS - 1] = 10;
+  check(1 == nio_latencypercentile(&latency, 50.0) &&
+            1 == nio_latencypercentile(&latency, 90.0) &&
+            1000 == nio_latencypercentile(&latency, 95.0) &&
+            1000 == nio_latencypercentile(&latency, 100.0),
+        "latency percentiles pick the right bucket");
+
+  sel = nio_selector();
+  selector_setstall(sel, 10000, test_stalled, NULL);
+
+  selector_select(sel, monitors, 4, 0);
+  selector_select(sel, monitors, 4, 0);
+
+  /* ~20 ms of work between two calls, millisecond ticks may cut it short */
+  for (prev = nio_millisec(); nio_millisec() < prev + 20;)
+    ;
+  selector_select(sel, monitors, 4, 0);
+
+  selector_latency(sel, &latency);
+  check(2 == latency.count && latency.max >= 15000 && stalled >= 15000 &&
+            nio_latencypercentile(&latency, 100.0) == latency.max,
+        "selector records loop latency and stalls");
+
+  selector_destroy(sel);
+}
+
+static void test_tcpinfo(void) {
+  niosocket_t client, server, udp, listener;
+  niosockaddr_t addr;
+  niotcpinfo_t info;
+  char buffer[1000];
+
+  if (0 != tcppair(&client, &server)) {
+    check(0, "tcpinfo on loopback");
+    return;
+  }
+
+  memset(buffer, 'x', sizeof(buffer));
+  nio_sendall(&client, buffer, sizeof(buffer));
+  nio_recvall(&server, buffer, sizeof(buffer));
+
+  memset(&info, 0, sizeof(info));
+  check(0 == nio_tcpinfo(&client, &info) && info.established &&
+            info.mss > 0 && info.cwnd > 0,
+        "tcpinfo on an established connection");
+
+  nio_createtcp4(&listener);
+  nio_hostaddr(&addr, "127.0.0.1", 0);
+  nio_bind(&listener, &addr);
+  nio_listen(&listener, 1);
+  check(0 == nio_tcpinfo(&listener, &info) && !info.established,
+        "tcpinfo on a listener");
+
+  nio_createudp4(&udp);
+  check(-1 == nio_tcpinfo(&udp, &info), "tcpinfo refuses udp");
+
+  nio_destroysocket(&udp);
+  nio_destroysocket(&listener);
+  nio_destroysocket(&client);
+  nio_destroysocket(&server);
+}
 
 int main(int argc, char *argv[]) {
   niohwaddr_t hwaddrs[8];
@@ -128,7 +1744,38 @@ int main(int argc, char *argv[]) {
   }
 
   selector_destroy(selector);
+
+  test_checksum();
+  test_checksumupdate();
+  test_frames();
+  test_records();
+  test_output();
+#ifndef _WIN32
+  test_pollbackend();
+#endif
+  test_timers();
+  test_connect();
+  test_cork();
+  test_connpool();
+  test_resolve();
+  test_listener();
+  test_acceptmany();
+  test_fastopen();
+  test_reuseportgroup();
+  test_busypoll();
+#ifndef _WIN32
+  test_signals();
+  test_shmchannel();
+  test_spawn();
+  test_unix();
+  test_passfds();
+#endif
+  test_deadlines();
+  test_stats();
+  test_latency();
+  test_tcpinfo();
+
   nio_finalize();
 
-  return 0;
+  return failures ? 1 : 0;
 }